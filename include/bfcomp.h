@@ -0,0 +1,47 @@
+#ifndef BFCOMP_H
+#define BFCOMP_H
+
+#include <stddef.h>
+
+/*
+ * Interface of objects built with `bfcomp --emit=object`.
+ */
+
+/*
+ * Values returned by bf_main.
+ */
+#define BF_OK 0
+#define BF_ERROR_TAPE 1  /* Tape is shorter than the stack size the program was compiled with. */
+#define BF_ERROR_READ 2  /* Read callback returned a negative value. */
+#define BF_ERROR_WRITE 3 /* Write callback returned a negative value. */
+
+/*
+ * Input and output of a program.
+ *
+ * read reads at most length bytes to buffer and returns their number,
+ * 0 at the end of input, or a negative value on error.
+ * write writes all length bytes from buffer and returns a negative value on error.
+ * Both are passed context. Output is buffered and written before reading
+ * more input and when the program ends.
+ */
+typedef struct bf_io {
+    long (*read)(void *context, unsigned char *buffer, size_t length);
+    long (*write)(void *context, const unsigned char *buffer, size_t length);
+    void *context;
+} bf_io;
+
+/*
+ * Runs the compiled program.
+ *
+ * The first stack_size * cell_size bytes of tape are cleared and used
+ * as the stack. All state is kept in tape and on the stack of the calling
+ * thread (about 8 KiB), so calls with different tapes can run concurrently.
+ *
+ * @param   io          Input and output callbacks.
+ * @param   tape        Memory for the stack.
+ * @param   tape_len    Size of tape in bytes.
+ * @return              BF_OK or one of BF_ERROR_* values.
+ */
+int bf_main(bf_io *io, void *tape, size_t tape_len);
+
+#endif
@@ -19,6 +19,40 @@ int output_file(size_t argc, char **argv);
 
 int assembly(size_t argc, char **argv);
 
+int emit(size_t argc, char **argv);
+
+int assembler(size_t argc, char **argv);
+
+int march(size_t argc, char **argv);
+
+int statistics(size_t argc, char **argv);
+
+int debug(size_t argc, char **argv);
+
+int tape(size_t argc, char **argv);
+
+int optimization_goal(size_t argc, char **argv);
+
+int memoize(size_t argc, char **argv);
+
+int introspect(size_t argc, char **argv);
+
+int max_steps(size_t argc, char **argv);
+
+int max_output(size_t argc, char **argv);
+
+int max_time(size_t argc, char **argv);
+
+int fork_server(size_t argc, char **argv);
+
+int serve_socket(size_t argc, char **argv);
+
+int workers(size_t argc, char **argv);
+
+int run(size_t argc, char **argv);
+
+int jit_threshold(size_t argc, char **argv);
+
 int file(size_t argc, char **argv);
 
 #endif
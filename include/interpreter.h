@@ -0,0 +1,46 @@
+#ifndef INTERPRETER_H
+#define INTERPRETER_H
+
+#include <stdint.h>
+
+/*
+ * Runs brainfuck code in this process.
+ *
+ * The optimized program is interpreted and loops whose back edges are taken
+ * settings.jit_threshold times are compiled to machine code, which takes over
+ * at the loop header with the same stack, so code that runs once starts
+ * immediately and hot loops run at the speed of compiled code.
+ *
+ * In case of an error writes it to errno.
+ * EINVAL if string wasn't provided.
+ * ENOCODE if the provided string contains no brainfuck code.
+ * EUNCLOSED if brackets were not closed.
+ * ENOMEM if memory allocation failed.
+ *
+ * @param   code    String with brainfuck code.
+ * @return          Exit status of the program.
+ */
+int execute(char *code);
+
+/*
+ * Input and output of executed programs, used by both tiers.
+ * Output is buffered and written before reading more input and when the program ends.
+ */
+
+/*
+ * Writes the lowest byte of the cell.
+ */
+void run_output(unsigned char *cell);
+
+/*
+ * Reads a character to the lowest byte of the cell, which is unchanged at the end of input.
+ */
+void run_input(unsigned char *cell);
+
+/*
+ * Runs INS_MAP_OUTPUT_INPUT or INS_MAP_INPUT_OUTPUT on a 1 byte cell,
+ * does nothing if the cell is 0.
+ */
+void run_map_loop(unsigned char *cell, int64_t value, int type);
+
+#endif
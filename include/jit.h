@@ -0,0 +1,50 @@
+#ifndef JIT_H
+#define JIT_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "program.h"
+
+/*
+ * Type of compiled loops.
+ *
+ * @param   tape        Stack of the program.
+ * @param   position    Offset of the current cell in bytes.
+ * @return              Offset of the current cell after the loop.
+ */
+typedef uint64_t (*JitFunction)(unsigned char *tape, uint64_t position);
+
+/*
+ * Loop compiled to machine code in executable memory.
+ */
+typedef struct {
+    JitFunction run;
+    size_t size;
+} JitLoop;
+
+/*
+ * Compiles a loop of an optimized program to x86-64 machine code.
+ *
+ * The code starts at the test of the loop, so it can be entered
+ * at the loop header, and returns when the loop ends.
+ * Moves wrap around the stack of settings.stack_size cells
+ * and input and output go through run_input, run_output and run_map_loop.
+ *
+ * In case of allocation error writes ENOMEM to errno.
+ *
+ * @param   program Program containing the loop.
+ * @param   start   Index of INS_LOOP_START.
+ * @param   end     Index of the matching INS_LOOP_END.
+ * @return          Compiled loop, free with free_jit_loop.
+ */
+JitLoop *jit_compile(Program *program, size_t start, size_t end);
+
+/*
+ * Frees compiled loop.
+ *
+ * @param   loop    Loop created with jit_compile.
+ */
+void free_jit_loop(JitLoop *loop);
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef LEXER_H
+#define LEXER_H
+
+#include <stddef.h>
+
+#include "program.h"
+
+/*
+ * Brainfuck code split into instructions.
+ *
+ * ops is the number of brainfuck commands in the code.
+ */
+typedef struct {
+    size_t length;
+    size_t ops;
+    Instruction *data;
+} Tokens;
+
+/*
+ * Splits brainfuck code into instructions, skipping comments.
+ *
+ * Classifies 32 bytes at a time with AVX2, SSSE3 or SSE2, whichever is the widest
+ * the processor supports, so blocks of comments are skipped at once and runs of `+-` and `<>`
+ * are folded into single instructions positioned at their first command.
+ * Loop instructions aren't labeled.
+ *
+ * In case of allocation error writes ENOMEM to errno.
+ *
+ * @param   code    Brainfuck code.
+ * @param   length  Length of the code.
+ * @return          Instructions, free with free_tokens.
+ */
+Tokens *lex(const char *code, size_t length);
+
+/*
+ * Frees tokens.
+ *
+ * @param   tokens  Tokens created with lex.
+ */
+void free_tokens(Tokens *tokens);
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+
+#include "program.h"
+
+/*
+ * Optimizes the program.
+ *
+ * Tracks values of cells known at compile time and uses them to
+ * remove loops that never run, evaluate loops whose effect is fully known,
+ * replace loops with a known trip count by closed-form updates,
+ * and unroll the remaining ones.
+ * Loops that only decrement their counter cell are replaced by setting it to 0.
+ *
+ * In case of allocation error writes ENOMEM to errno.
+ *
+ * @param   program Program to optimize.
+ * @return          Optimized program, the original program is freed.
+ */
+Program *optimize(Program *program);
+
+#endif
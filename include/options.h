@@ -30,6 +30,7 @@ typedef struct {
     size_t opt_argc;
     char **opt_argv;
     Option *option;
+    char *value;
 } ArgInfo;
 
 /*
@@ -84,6 +85,9 @@ void add_option(Options *options, char *key, char key_short,
  *                      OPTION_LONG will search long keys.
  *                      OPTION_SHORT will search short keys.
  * @param   key         Key to search for.
+ *                      Long keys are compared up to the first '='.
+ *                      Short keys of options taking arguments
+ *                      are compared only by the first character.
  * @return              Found Option, NULL if not found.
  */
 Option *get_option(Options *options, int type, char *key);
@@ -98,6 +102,11 @@ Option *get_option(Options *options, int type, char *key);
  *                      opt_argc is number of arguments provided to the option.
  *                      opt_argv is a pointer to the arguments provided to the option.
  *                      call is a pointer to a function that handles the option.
+ *                      Options written as `--key=value` or `-kvalue`
+ *                      are passed value as their only argument.
+ *                      Options taking no arguments given a value are invalid,
+ *                      options with only optional arguments take them
+ *                      only as a value.
  */
 ArgInfo *parse_argument(Options *options, size_t *argc, char ***argv);
 
@@ -0,0 +1,56 @@
+#ifndef OUTLINER_H
+#define OUTLINER_H
+
+#include <stddef.h>
+
+#include "program.h"
+
+/*
+ * Sequence of instructions emitted once as a subroutine.
+ *
+ * start is the index of its first occurrence in the program,
+ * which is used as the body of the subroutine.
+ */
+typedef struct {
+    size_t start;
+    size_t length;
+} Subroutine;
+
+/*
+ * Repeated sequences of a program replaced by calls.
+ *
+ * calls has an element for every instruction of the program,
+ * which is 0 or the number of the subroutine called instead
+ * of the sequence starting at the instruction increased by 1.
+ */
+typedef struct {
+    size_t count;
+    size_t size;
+    Subroutine *data;
+    size_t *calls;
+} Outline;
+
+/*
+ * Finds repeated sequences of instructions that are worth
+ * moving into subroutines to reduce the size of the code.
+ *
+ * Sequences are found by hashing windows of instructions, from the longest
+ * to the shortest, and extended as long as all occurrences are equal.
+ * Only sequences with matched brackets are outlined, and only
+ * if the estimated saving outweighs the cost of calls and returns.
+ *
+ * In case of allocation error writes ENOMEM to errno.
+ *
+ * @param   program Program to search.
+ * @return          Subroutines and their call sites.
+ */
+Outline *outline_program(Program *program);
+
+/*
+ * Frees outline.
+ *
+ * @param   outline Outline created with outline_program.
+ */
+void free_outline(Outline *outline);
+
+#endif
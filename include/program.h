@@ -0,0 +1,112 @@
+#ifndef PROGRAM_H
+#define PROGRAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Types of instructions.
+ */
+#define INS_MOVE 1       /* Move stack pointer by value. */
+#define INS_ADD 2        /* Add value to the current cell. */
+#define INS_OUTPUT 3     /* Print the current cell. */
+#define INS_INPUT 4      /* Read a character into the current cell. */
+#define INS_LOOP_START 5 /* Start loop with label value. */
+#define INS_LOOP_END 6   /* End loop with label value. */
+#define INS_SET 7        /* Set the current cell to value. */
+#define INS_MAP_OUTPUT_INPUT 8 /* Loop `[+.,]` adding value, runs until it reads 0. */
+#define INS_MAP_INPUT_OUTPUT 9 /* Loop `[,+.]` adding value, runs until it prints 0. */
+
+/*
+ * Single instruction of a folded brainfuck program.
+ *
+ * line and column are the position of its first character in the source code.
+ */
+typedef struct {
+    char type;
+    int64_t value;
+    size_t line;
+    size_t column;
+} Instruction;
+
+/*
+ * Brainfuck program as a list of folded instructions.
+ *
+ * line and column are assigned to instructions added with push_instruction.
+ */
+typedef struct {
+    size_t length;
+    size_t size;
+    Instruction *data;
+    size_t line;
+    size_t column;
+} Program;
+
+/*
+ * Parses brainfuck code into a list of instructions,
+ * folding runs of `+-` and `<>` into single instructions.
+ *
+ * In case of an error writes it to errno.
+ * EINVAL if string wasn't provided.
+ * ENOCODE if the provided string contains no brainfuck code.
+ * EUNCLOSED if brackets were not closed.
+ * ENOMEM if memory allocation failed.
+ *
+ * @param   code    String with brainfuck code.
+ * @return          Parsed program.
+ */
+Program *parse_program(char *code);
+
+/*
+ * Creates an empty program.
+ *
+ * In case of allocation error writes ENOMEM to errno.
+ *
+ * @return          Empty program.
+ */
+Program *init_program();
+
+/*
+ * Frees program.
+ *
+ * @param   program Program created with parse_program or init_program.
+ */
+void free_program(Program *program);
+
+/*
+ * Appends an instruction to the program at position set in program->line
+ * and program->column.
+ *
+ * Merges it with the last instruction when possible:
+ * adjacent moves and additions are summed,
+ * addition after set changes the set value, set replaces addition or set,
+ * and moves or additions by 0 are dropped.
+ *
+ * In case of allocation error writes ENOMEM to errno.
+ *
+ * @param   program Program to append to.
+ * @param   type    Type of the instruction.
+ * @param   value   Value of the instruction.
+ */
+void push_instruction(Program *program, char type, int64_t value);
+
+/*
+ * Assigns unique label numbers to loops in order of their appearance.
+ * Both instructions of a loop get the same number.
+ *
+ * In case of allocation error writes ENOMEM to errno.
+ *
+ * @param   program Program to label.
+ */
+void label_loops(Program *program);
+
+/*
+ * Returns index of the instruction that ends loop started at start.
+ *
+ * @param   program Program containing the loop.
+ * @param   start   Index of INS_LOOP_START.
+ * @return          Index of the matching INS_LOOP_END.
+ */
+size_t loop_end(Program *program, size_t start);
+
+#endif
@@ -0,0 +1,193 @@
+#ifndef RUNTIME_H
+#define RUNTIME_H
+
+#include <stddef.h>
+
+/*
+ * Assembly of routines used by the compiled code.
+ * Each routine is written only if the code uses it.
+ * Routines are written in syntax accepted by both NASM and GNU as with .intel_syntax,
+ * their data is declared by the compiler.
+ */
+
+/*
+ * Memory reserved in .bss for routines.
+ */
+typedef struct {
+    const char *name;
+    size_t size;
+} RuntimeData;
+
+/*
+ * bf_tape_error prints an error and exits with status 1
+ * when memory for the stack couldn't be allocated.
+ * Requires TAPE_ERROR_MESSAGE followed by a newline as bf_tape_message.
+ */
+extern const char runtime_tape_error[];
+
+#define TAPE_ERROR_MESSAGE "Failed to allocate memory for the stack."
+
+/*
+ * Buffered input and output.
+ *
+ * bf_read reads a character to [rsi], which is left unchanged at the end of input.
+ * bf_flush writes the output buffer.
+ * Output buffer is always flushed before waiting for more input.
+ * Requires buffers in runtime_io_data.
+ */
+extern const char runtime_io[];
+
+/* Buffers of runtime_io, terminated by an element without a name. */
+extern const RuntimeData runtime_io_data[];
+
+/*
+ * Frame of bf_main in objects, addressed by rbx.
+ * Holds bf_io pointer, input position and length, output length, both buffers
+ * and kernels of scan loops selected by bf_scan_dispatch.
+ * Its size keeps rsp aligned to 16 bytes after pushing 6 registers.
+ */
+#define OBJECT_IO 0
+#define OBJECT_IN_POS 8
+#define OBJECT_IN_LEN 16
+#define OBJECT_OUT_LEN 24
+#define OBJECT_IN_BUF 32
+#define OBJECT_BUFFER_SIZE 4096
+#define OBJECT_OUT_BUF (OBJECT_IN_BUF + OBJECT_BUFFER_SIZE)
+#define OBJECT_SCAN_KERNELS (OBJECT_OUT_BUF + OBJECT_BUFFER_SIZE)
+#define OBJECT_FRAME_SIZE 8248
+
+/*
+ * Input, output and return of bf_main in objects.
+ *
+ * bf_read reads a character to [rsi] and bf_write writes the character at [rsi]
+ * using callbacks of bf_io, which are called with rsp aligned to 16 bytes.
+ * bf_flush writes the output buffer.
+ * bf_return restores registers and returns eax, bf_fail does it from any depth of calls.
+ */
+extern const char runtime_object[];
+
+/*
+ * Loops `[+.,]` and `[,+.]`.
+ *
+ * bf_map_loop runs the loop on cell in r12b, which must not be 0,
+ * adding dil to it, with sil set to 0 for `[+.,]` and 1 for `[,+.]`.
+ * Returns with r12b set to 0, the cell in memory isn't updated.
+ * Requires runtime_io.
+ */
+extern const char runtime_map_loop[];
+
+/*
+ * Loops `[>]` and `[<]` with 1 byte cells.
+ *
+ * bf_scan_right_<isa> and bf_scan_left_<isa> move r13 to the nearest cell at or after
+ * and at or before it that is 0, wrapping around the stack of rcx bytes at r15.
+ * Cells are compared a whole aligned block at a time, which never crosses a page,
+ * and bytes of the block outside of the stack are ignored.
+ * Variants use SSE2, AVX2 or AVX-512BW and are written for --march.
+ */
+extern const char runtime_scan_sse2[];
+extern const char runtime_scan_avx2[];
+extern const char runtime_scan_avx512[];
+
+/*
+ * bf_scan_dispatch stores addresses of the best scan kernels supported
+ * by the processor and the operating system to [rdi] for `[>]` and [rdi + 8] for `[<]`.
+ * Requires all variants of the scan kernels.
+ */
+extern const char runtime_scan_dispatch[];
+
+/*
+ * bf_number writes rax in decimal followed by a newline to stderr.
+ */
+extern const char runtime_number[];
+
+/*
+ * Cache of loops memoized with --memoize.
+ *
+ * Every loop has a cache of MEMO_ENTRIES entries after a pointer to the entry
+ * being filled. Entries hold a valid flag, the window of cells before the loop
+ * and after it, both padded to 8 bytes.
+ * bf_memo_find looks up the window at rdi in the cache at rsi, with rdx size of the window
+ * and rcx size of entries. On a hit it replaces the window by the cached state and returns 1,
+ * on a miss it saves the window to the entry and returns 0.
+ * bf_memo_store called with the same arguments after the loop fills the entry.
+ * bf_memo_report writes numbers of hits and misses to stderr.
+ * Requires runtime_number, counters in runtime_memo_data, MEMO_HITS_TEXT as bf_memo_hits_text
+ * and MEMO_MISSES_TEXT as bf_memo_misses_text.
+ */
+extern const char runtime_memo[];
+
+/* Counters of runtime_memo, terminated by an element without a name. */
+extern const RuntimeData runtime_memo_data[];
+
+#define MEMO_ENTRIES 256
+#define MEMO_HASH_SHIFT 56 /* Keeps 8 bits of the hash for MEMO_ENTRIES. */
+#define MEMO_HITS_TEXT "memo hits: "
+#define MEMO_MISSES_TEXT "memo misses: "
+
+/*
+ * Report of the state of executables built with --introspect.
+ *
+ * bf_introspect_install installs bf_introspect as the handler of SIGUSR1,
+ * which writes INTROSPECT_FORMAT with # replaced by the source position, the current cell,
+ * rbx counting tests of loops, and numbers of reads and writes.
+ * The source position is found in bf_positions, entries of the address of code,
+ * its line and column, ending at bf_positions_end. Runtime routines follow the label
+ * bf_pos_runtime and report the instruction that called them.
+ * Requires counters in runtime_introspect_data, INTROSPECT_FORMAT followed by a newline
+ * as bf_introspect_format, a quadword bf_cell_size and the path of the file to append to
+ * as a string bf_introspect_path ending with a zero byte, which is empty for stderr.
+ */
+extern const char runtime_introspect[];
+
+/* Counters of runtime_introspect, terminated by an element without a name. */
+extern const RuntimeData runtime_introspect_data[];
+
+#define INTROSPECT_FORMAT "bf: line #, column #, cell #, loop tests #, reads #, writes #"
+
+/*
+ * Execution budgets of executables built with --max_steps, --max_output and --max_time.
+ *
+ * The code counts down remaining steps in rbp and remaining characters of output
+ * in bf_output_left and jumps to bf_limit_steps or bf_limit_output when one goes below 0.
+ * bf_limit_timer installs bf_limit_time as the handler of SIGALRM and starts a timer
+ * of rdi seconds and rsi microseconds.
+ * All of them write LIMIT_*_TEXT, the numbers of steps and characters of output used
+ * to stderr and exit with LIMIT_STATUS_*.
+ * Requires runtime_number, the counter in runtime_limit_data, the initial values of both counters
+ * as quadwords bf_limit_budget, LIMIT_*_TEXT followed by a newline as bf_limit_*_text
+ * and LIMIT_STEPS_LABEL and LIMIT_OUTPUT_LABEL as bf_limit_steps_label and bf_limit_output_label.
+ */
+extern const char runtime_limit[];
+
+/* Counter of runtime_limit, terminated by an element without a name. */
+extern const RuntimeData runtime_limit_data[];
+
+#define LIMIT_STATUS_STEPS 122
+#define LIMIT_STATUS_OUTPUT 123
+#define LIMIT_STATUS_TIME 124 /* Same as timeout(1). */
+#define LIMIT_STEPS_TEXT "bf: step limit exceeded"
+#define LIMIT_OUTPUT_TEXT "bf: output limit exceeded"
+#define LIMIT_TIME_TEXT "bf: time limit exceeded"
+#define LIMIT_STEPS_LABEL "steps: "
+#define LIMIT_OUTPUT_LABEL "output bytes: "
+
+/*
+ * Fork server of executables built with --fork_server.
+ *
+ * bf_fork_server waits for requests on the Unix socket FORK_SERVER_FD. Every request
+ * is a single byte with descriptors of standard input and output of the run attached,
+ * which are optional. A child forked for the request returns from bf_fork_server
+ * with them as descriptors 0 and 1 and runs the program, the server sends its wait status
+ * as 4 bytes back when it exits and waits for the next request. A request with descriptors
+ * other than exactly these two isn't run, its descriptors are closed and the status
+ * is -1, same as when fork fails. Exits with status 0
+ * when the socket is closed. If FORK_SERVER_FD isn't a socket returns immediately,
+ * so the program runs once as usual.
+ * Preserves all registers used by the compiled code.
+ */
+extern const char runtime_fork_server[];
+
+#define FORK_SERVER_FD 198
+
+#endif
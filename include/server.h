@@ -0,0 +1,48 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stddef.h>
+
+/* Environment variable with path to the socket of a compile server used by the client. */
+#define SERVER_VARIABLE "BFCOMP_SERVER"
+
+/*
+ * Type for functions handling requests of the server.
+ *
+ * @param   argc    Number of command line arguments of the request.
+ * @param   argv    Command line arguments of the request, without the program name.
+ * @return          Exit status sent back to the client.
+ */
+typedef int (*RequestHandler)(size_t argc, char **argv);
+
+/*
+ * Runs a compile server listening on a Unix socket.
+ *
+ * Starts a pool of workers, which accept requests and handle each
+ * of them in a child process forked from the worker, in the directory
+ * and with standard input, output and error of the client.
+ * Workers that exit are replaced. Runs until SIGINT or SIGTERM.
+ *
+ * Exits with an error if the socket can't be created.
+ *
+ * @param   path    Path to the socket.
+ * @param   workers Number of workers, 0 for the number of processors.
+ * @param   handler Function that handles requests.
+ */
+void serve(const char *path, size_t workers, RequestHandler handler);
+
+/*
+ * Sends command line arguments to the compile server
+ * and waits until it handles them.
+ *
+ * The current directory and the standard input, output and error
+ * are passed to the server with the arguments.
+ *
+ * @param   path    Path to the socket of the server.
+ * @param   argc    Number of arguments.
+ * @param   argv    Arguments without the program name.
+ * @return          Exit status of the request, -1 if the server couldn't be reached.
+ */
+int request_server(const char *path, size_t argc, char **argv);
+
+#endif
@@ -3,13 +3,62 @@
 
 #include <stddef.h>
 
+/*
+ * Ways of allocating the stack.
+ */
+#define TAPE_AUTO 0 /* .bss for small stacks, mmap for large ones. */
+#define TAPE_BSS 1  /* Array in .bss. */
+#define TAPE_MMAP 2 /* mmap with MAP_NORESERVE. */
+#define TAPE_HUGE 3 /* mmap backed by huge pages. */
+
+/* Largest stack in bytes allocated in .bss by TAPE_AUTO. */
+#define TAPE_BSS_LIMIT (256 * 1024 * 1024)
+
+/*
+ * Types of output files.
+ */
+#define EMIT_EXECUTABLE 0
+#define EMIT_ASSEMBLY 1
+#define EMIT_OBJECT 2 /* Relocatable object with bf_main declared in bfcomp.h. */
+
+/*
+ * Assemblers of the generated code.
+ */
+#define ASSEMBLER_NASM 0
+#define ASSEMBLER_GAS 1 /* GNU as with .intel_syntax. */
+
+/*
+ * Instruction sets available to runtime kernels.
+ */
+#define MARCH_X86_64 0 /* SSE2. */
+#define MARCH_V3 1     /* AVX2 and BMI. */
+#define MARCH_V4 2     /* AVX-512. */
+#define MARCH_DISPATCH 3 /* All kernels, selected by cpuid at startup. */
+
 typedef struct {
     char *program_name;
     char *input_file;
     char *output_file;
     size_t stack_size;
     size_t cell_size;
-    char assembly;
+    char emit;
+    char assembler;
+    char march;
+    char stats;
+    char debug;
+    char tape;
+    char optimize_size;
+    char memoize;
+    char introspect;
+    char *introspect_file;
+    size_t max_steps;
+    size_t max_output;
+    size_t max_time;
+    char fork_server;
+    char *serve;
+    size_t workers;
+    char run;
+    size_t jit_threshold;
     char *operation_register;
     char *data_unit;
 } Settings;
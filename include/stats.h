@@ -0,0 +1,103 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include <time.h>
+
+#define STATS_OFF 0
+#define STATS_TEXT 1
+#define STATS_JSON 2
+
+/*
+ * Phases of a build that are timed separately.
+ */
+#define PHASE_READ 0
+#define PHASE_COMPILE 1
+#define PHASE_LEX 2 /* Part of PHASE_COMPILE. */
+#define PHASE_WRITE 3
+#define PHASE_ASSEMBLE 4
+#define PHASE_LINK 5
+#define PHASE_RUN 6 /* Running the program with --run. */
+#define PHASE_COUNT 7
+
+/*
+ * Optimizations whose applications are counted.
+ */
+#define OPT_FOLD 0
+#define OPT_DEAD_LOOP 1
+#define OPT_EVALUATE 2
+#define OPT_CLOSED_FORM 3
+#define OPT_UNROLL 4
+#define OPT_CLEAR 5
+#define OPT_IO_LOOP 6
+#define OPT_OUTLINE 7
+#define OPT_JIT 8 /* Loops compiled while running. */
+#define OPT_BRANCHLESS 9
+#define OPT_MEMO 10 /* Loops memoized with --memoize. */
+#define OPT_SCAN 11
+#define OPT_COUNT 12
+
+/*
+ * Wall and CPU time spent in a single phase.
+ *
+ * CPU time includes child processes, so that time spent
+ * in `nasm` and `ld` is accounted to their phases.
+ */
+typedef struct {
+    char ran;
+    double wall;
+    double cpu;
+    struct timespec wall_start;
+    double cpu_start;
+} Phase;
+
+/*
+ * Counters collected during a build.
+ */
+typedef struct {
+    Phase phases[PHASE_COUNT];
+    size_t input_bytes;
+    size_t lexed_bytes;
+    size_t bf_ops;
+    size_t instructions;
+    size_t loops;
+    size_t optimizations[OPT_COUNT];
+    size_t assembly_bytes;
+    size_t text_bytes;
+} Stats;
+
+extern Stats stats;
+
+/*
+ * Starts timing a phase.
+ *
+ * Does nothing unless statistics were requested.
+ *
+ * @param   phase   One of PHASE_* values.
+ */
+void stats_start(int phase);
+
+/*
+ * Stops timing a phase started with stats_start.
+ *
+ * @param   phase   One of PHASE_* values.
+ */
+void stats_stop(int phase);
+
+/*
+ * Returns size of executable sections of an ELF file.
+ *
+ * @param   path    Path to the file.
+ * @return          Size in bytes, 0 if the file couldn't be read.
+ */
+size_t text_size(const char *path);
+
+/*
+ * Prints collected statistics in the format selected by settings.stats.
+ *
+ * @param   stream  Stream to print to.
+ */
+void print_stats(FILE *stream);
+
+#endif
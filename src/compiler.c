@@ -5,9 +5,15 @@
 #include <stdlib.h>
 #include <string.h>
 
+#include "bfcomp.h"
 #include "compiler.h"
 #include "defines.h"
+#include "optimizer.h"
+#include "outliner.h"
+#include "program.h"
+#include "runtime.h"
 #include "settings.h"
+#include "stats.h"
 
 /*
  * Struct storing compiled code.
@@ -19,63 +25,294 @@ typedef struct {
 } CompileBuffer;
 
 /*
- * Stores information about the instruction that should be written to the buffer
+ * Stores state of the registers between instructions.
+ *
+ * flags_valid means that the zero flag reflects the current cell,
+ * so it doesn't have to be compared with 0 again.
+ * value_known and nonzero describe the current cell when it is known
+ * at this point of the code, e.g. it's 0 after a loop
+ * and it isn't 0 at the start of a loop body.
+ * labels counts labels used internally by instructions
+ * and steps instructions not charged to the step counter of budgets yet.
  */
 typedef struct {
-    char type;
     char read_needed;
     char write_needed;
     char increment_needed;
+    char flags_valid;
+    char value_known;
+    char nonzero;
+    uint64_t value;
+    size_t labels;
+    size_t steps;
+} CodeState;
+
+/* Largest number of cells updated by an "if" loop written without branches. */
+#define IF_MAX_CELLS 4
+
+/* Largest window of cells of a memoized loop in bytes and depth of loops in it. */
+#define MEMO_MAX_WINDOW 64
+#define MEMO_MAX_DEPTH 16
+
+/*
+ * Loop being written with memoization.
+ *
+ * end is the index of its INS_LOOP_END, SIZE_MAX if there is none,
+ * first the offset of the first cell of the window in cells and cells its length.
+ */
+typedef struct {
+    size_t end;
     int64_t value;
-} Instruction;
+    size_t label;
+    int64_t first;
+    size_t cells;
+} MemoLoop;
+
+/*
+ * Update of a cell by an "if" loop.
+ *
+ * offset is the distance from the loop cell in bytes, between 0 and the size of the stack.
+ */
+typedef struct {
+    size_t offset;
+    char type;
+    uint64_t value;
+} IfUpdate;
+
+/*
+ * Directives of an assembler.
+ *
+ * global takes the name of a function twice, reserve a name and a size in bytes,
+ * string a name and a line of text, ascii a name and text without a newline,
+ * asciz a name and text ending with a zero byte, quad is the directive of quadwords,
+ * line takes a line number and the source file.
+ * pointer follows size specifiers of memory operands.
+ */
+typedef struct {
+    const char *header;
+    const char *file;
+    const char *text;
+    const char *bss;
+    const char *rodata;
+    const char *global;
+    const char *reserve;
+    const char *string;
+    const char *ascii;
+    const char *asciz;
+    const char *quad;
+    const char *line;
+    const char *pointer;
+    const char *stack_note;
+} Syntax;
+
+static const Syntax nasm_syntax = {
+    .header = "",
+    .file = "",
+    .text = "section .text\n",
+    .bss = "section .bss\n",
+    .rodata = "section .rodata\n",
+    .global = "global %s:function\n",
+    .reserve = "%s resb %zu\n",
+    .string = "%s db \"%s\", 10\n",
+    .line = "%%line %zu+0 %s\n",
+    .ascii = "%s db \"%s\"\n",
+    .asciz = "%s db \"%s\", 0\n",
+    .quad = "dq",
+    .pointer = "",
+    .stack_note = "section .note.GNU-stack noalloc noexec nowrite progbits\n"
+};
+
+/* GNU as in Intel syntax, source lines are mapped by .loc. */
+static const Syntax gas_syntax = {
+    .header = ".intel_syntax noprefix\n",
+    .file = ".file 1 \"%s\"\n",
+    .text = ".text\n",
+    .bss = ".bss\n",
+    .rodata = ".section .rodata\n",
+    .global = ".globl %s\n.type %s, @function\n",
+    .reserve = "%s: .skip %zu\n",
+    .string = "%s: .ascii \"%s\\n\"\n",
+    .line = ".loc 1 %zu\n",
+    .ascii = "%s: .ascii \"%s\"\n",
+    .asciz = "%s: .asciz \"%s\"\n",
+    .quad = ".quad",
+    .pointer = " ptr",
+    .stack_note = ".section .note.GNU-stack,\"\",@progbits\n"
+};
+
+/* Syntax of the code being compiled and size specifier of cells in it. */
+static const Syntax *syntax = &nasm_syntax;
+static char data_unit[16];
+
+/* Memoized loop containing the code being written and number of loops memoized by the code. */
+static MemoLoop memo = { .end = SIZE_MAX };
+static size_t memoized;
+
+/* Code is written for --introspect, positions counts entries of its table of source positions. */
+static char introspect;
+static size_t positions;
+
+/* Budgets of executables, steps are counted down in rbp. */
+static char limits;
+
+/* Names of scan kernels for each --march level, the dispatched one is called through a pointer. */
+static const char *scan_kernels[] = { "sse2", "avx2", "avx512", NULL };
 
 #define INS_WRITE_NEEDED                                         \
-    if (instruction->write_needed) {                             \
+    if (state->write_needed) {                                   \
         buffer->length += sprintf(buffer->data + buffer->length, \
             "mov %s [r14], %s\n",                                \
-            settings.data_unit,                                  \
+            data_unit,                                           \
             settings.operation_register);                        \
-        instruction->write_needed = 0;                           \
+        state->write_needed = 0;                                 \
     }
 
 #define INS_READ_NEEDED                                          \
-    if (instruction->read_needed) {                              \
+    if (state->read_needed) {                                    \
         buffer->length += sprintf(buffer->data + buffer->length, \
             "mov %s, %s [r14]\n",                                \
             settings.operation_register,                         \
-            settings.data_unit);                                 \
-        instruction->read_needed = 0;                            \
+            data_unit);                                          \
+        state->read_needed = 0;                                  \
+    }
+
+#define INS_STEPS_NEEDED                                         \
+    if (limits && state->steps) {                                \
+        buffer->length += sprintf(buffer->data + buffer->length, \
+            "lea rbp, [rbp - %zu]\n",                            \
+            state->steps);                                       \
+        state->steps = 0;                                        \
     }
 
 #define INS_INCREMENT_NEEDED                                     \
-    if (instruction->increment_needed) {                         \
+    if (state->increment_needed) {                               \
         buffer->length += sprintf(buffer->data + buffer->length, \
-            "mov r14, stack\n"                                   \
-            "add r14, r13\n");                                   \
-        instruction->increment_needed = 0;                       \
+            "lea r14, [r15 + r13]\n");                           \
+        state->increment_needed = 0;                             \
     }
 
+/*
+ * Returns mask of the bits that fit in a cell.
+ */
+static uint64_t cell_mask()
+{
+    return settings.cell_size >= 8 ? UINT64_MAX : ((uint64_t)1 << (settings.cell_size * 8)) - 1;
+}
+
+/*
+ * Makes sure there is space for at least length more characters in the buffer.
+ *
+ * In case of allocation error frees the buffer and writes ENOMEM to errno.
+ */
+static void reserve_buffer(CompileBuffer *buffer, size_t length)
+{
+    if (buffer->length + length + 1 <= buffer->size)
+        return;
+
+    while (buffer->length + length + 1 > buffer->size)
+        buffer->size *= 2;
+
+    char *tmp = realloc(buffer->data, buffer->size);
+    MEMERRVF(tmp, buffer->data);
+    buffer->data = tmp;
+}
+
+/*
+ * Writes a symbol of type function at the current position,
+ * named after the position of instruction in the source code,
+ * so that profilers and debuggers can tell which loop the code belongs to.
+ */
+static void write_symbol(CompileBuffer *buffer, Instruction *instruction, const char *kind)
+{
+    char name[96];
+    sprintf(name, "bf_L%zu_C%zu_%s%" PRId64,
+        instruction->line, instruction->column, kind, instruction->value);
+    buffer->length += sprintf(buffer->data + buffer->length, syntax->global, name, name);
+    buffer->length += sprintf(buffer->data + buffer->length, "%s:\n", name);
+}
+
+/*
+ * Maps the following code to the line of instruction in the source code
+ * if it differs from *line.
+ *
+ * In case of allocation error frees the buffer and writes ENOMEM to errno.
+ */
+static void write_line(CompileBuffer *buffer, Instruction *instruction, size_t *line)
+{
+    if (!settings.debug || instruction->line == *line)
+        return;
+
+    *line = instruction->line;
+    reserve_buffer(buffer, strlen(settings.input_file) + 64);
+    if (errno)
+        return;
+    buffer->length += sprintf(buffer->data + buffer->length,
+        syntax->line, *line, settings.input_file);
+}
+
+/*
+ * Labels the following code with the position of instruction in the source code
+ * and adds an entry to bf_positions, which is read by the SIGUSR1 handler.
+ * Entries are sorted by address, because the table is written in the same order as the code.
+ *
+ * In case of allocation error frees the buffer and writes ENOMEM to errno.
+ */
+static void write_position(CompileBuffer *buffer, Instruction *instruction)
+{
+    if (!introspect)
+        return;
+
+    reserve_buffer(buffer, 255);
+    if (errno)
+        return;
+    buffer->length += sprintf(buffer->data + buffer->length, "bf_pos%zu:\n", positions);
+    buffer->length += sprintf(buffer->data + buffer->length, "%s", syntax->rodata);
+    buffer->length += sprintf(buffer->data + buffer->length, "%s bf_pos%zu, %zu, %zu\n",
+        syntax->quad, positions, instruction->line, instruction->column);
+    buffer->length += sprintf(buffer->data + buffer->length, "%s", syntax->text);
+    ++positions;
+}
+
+/*
+ * Points r14 to the current cell and loads it to the register,
+ * which is the state at calls to subroutines and returns from them.
+ *
+ * In case of allocation error frees the buffer and writes ENOMEM to errno.
+ */
+static void write_call_state(CompileBuffer *buffer, CodeState *state)
+{
+    reserve_buffer(buffer, 127);
+    if (errno)
+        return;
+
+    INS_INCREMENT_NEEDED
+    INS_READ_NEEDED
+    INS_STEPS_NEEDED
+}
+
 /*
  * Writes assembly equivalent to specified brainfuck instruction.
  *
  * @param   buffer      CompileBuffer to write to.
+ * @param   state       State of the registers, updated by the instruction.
  * @param   instruction Instruction to be written.
  */
-void write_instruction(CompileBuffer *buffer, Instruction *instruction)
+void write_instruction(CompileBuffer *buffer, CodeState *state, Instruction *instruction)
 {
     /* Make sure there is enough space in the buffer. */
-    if (buffer->length + 255 > buffer->size) {
-        buffer->size *= 2;
-        char *tmp = realloc(buffer->data, buffer->size);
-        MEMERRVF(tmp, buffer->data);
-        buffer->data = tmp;
-    }
+    reserve_buffer(buffer, 511);
+    if (errno)
+        return;
 
     char *ins;
     int64_t value;
+    uint64_t constant;
+
+    ++stats.instructions;
+    ++state->steps;
 
     switch (instruction->type) {
-    case 1:
+    case INS_MOVE:
         /* Move stack pointer by value. */
         INS_WRITE_NEEDED
 
@@ -90,252 +327,1135 @@ void write_instruction(CompileBuffer *buffer, Instruction *instruction)
             "mov r13, rdx\n",
             value * settings.cell_size,
             settings.stack_size * settings.cell_size);
+
+        state->read_needed = 1;
+        state->increment_needed = 1;
+        state->flags_valid = 0;
+        state->value_known = 0;
+        state->nonzero = 0;
         break;
-    case 2:
+    case INS_ADD:
         /* Increase value in a cell pointed to by the stack pointer by value. */
         INS_INCREMENT_NEEDED
         INS_READ_NEEDED
 
-        if (instruction->value < 0) {
+        /* Values are added modulo the cell size, so subtract when it's shorter. */
+        constant = (uint64_t)instruction->value & cell_mask();
+        if (constant > cell_mask() / 2) {
             ins = "sub";
-            value = -instruction->value;
+            constant = (cell_mask() - constant) + 1;
         } else {
             ins = "add";
-            value = instruction->value;
         }
 
+        /* Immediate operands are at most 32 bits long. */
+        if (constant > INT32_MAX)
+            buffer->length += sprintf(buffer->data + buffer->length,
+                "mov rax, %" PRIu64 "\n"
+                "%s %s, rax\n",
+                constant, ins, settings.operation_register);
+        else
+            buffer->length += sprintf(buffer->data + buffer->length,
+                "%s %s, %" PRIu64 "\n",
+                ins, settings.operation_register, constant);
+
+        /* Addition sets the zero flag according to the result. */
+        state->write_needed = 1;
+        state->flags_valid = 1;
+        state->value = (state->value + instruction->value) & cell_mask();
+        state->nonzero = state->value_known && state->value;
+        break;
+    case INS_SET:
+        /* Set value of a cell pointed to by the stack pointer. */
+        constant = (uint64_t)instruction->value & cell_mask();
+
+        /* Skip if the cell already has this value. */
+        if (state->value_known && state->value == constant)
+            break;
+
+        INS_INCREMENT_NEEDED
+
         buffer->length += sprintf(buffer->data + buffer->length,
-            "%s %s, %" PRId64 "\n",
-            ins, settings.operation_register, value);
+            "mov %s, %" PRIu64 "\n",
+            settings.operation_register, constant);
+
+        state->read_needed = 0;
+        state->write_needed = 1;
+        state->flags_valid = 0;
+        state->value_known = 1;
+        state->value = constant;
+        state->nonzero = constant != 0;
         break;
-    case 3:
+    case INS_OUTPUT:
         /* Print character in the cell pointed to by the stack pointer. */
         INS_WRITE_NEEDED
         INS_INCREMENT_NEEDED
 
-        buffer->length += sprintf(buffer->data + buffer->length,
-            "mov rax, 1\n"
-            "mov rdi, 1\n"
-            "mov rsi, r14\n"
-            "mov rdx, 1\n"
-            "syscall\n");
+        /* The counter is restored when the character doesn't fit. */
+        if (limits)
+            buffer->length += sprintf(buffer->data + buffer->length,
+                "dec qword%s [bf_output_left]\n"
+                "js bf_limit_output\n",
+                syntax->pointer);
+
+        if (settings.emit == EMIT_OBJECT)
+            buffer->length += sprintf(buffer->data + buffer->length,
+                "mov rsi, r14\n"
+                "call bf_write\n");
+        else
+            buffer->length += sprintf(buffer->data + buffer->length,
+                "mov rax, 1\n"
+                "mov rdi, 1\n"
+                "mov rsi, r14\n"
+                "mov rdx, 1\n"
+                "syscall\n");
+
+        if (introspect)
+            buffer->length += sprintf(buffer->data + buffer->length,
+                "inc qword%s [bf_writes]\n",
+                syntax->pointer);
+
+        state->flags_valid = 0;
         break;
-    case 4:
-        /* Read character from stdin to the cell pointed to by the stack pointer. */
+    case INS_INPUT:
+        /*
+         * Read character from stdin to the cell pointed to by the stack pointer.
+         * The cell is written first, because it's left unchanged at the end of input.
+         */
+        INS_WRITE_NEEDED
         INS_INCREMENT_NEEDED
 
         buffer->length += sprintf(buffer->data + buffer->length,
-            "mov rax, 0\n"
-            "mov rdi, 0\n"
             "mov rsi, r14\n"
-            "mov rdx, 1\n"
-            "syscall\n");
+            "call bf_read\n");
+
+        if (introspect)
+            buffer->length += sprintf(buffer->data + buffer->length,
+                "inc qword%s [bf_reads]\n",
+                syntax->pointer);
+
+        state->read_needed = 1;
+        state->flags_valid = 0;
+        state->value_known = 0;
+        state->nonzero = 0;
         break;
-    case 5:
-        /* Start loop. */
+    case INS_MAP_OUTPUT_INPUT:
+    case INS_MAP_INPUT_OUTPUT:
+        /* Loop passing input to output, adding value to every character. */
         INS_WRITE_NEEDED
         INS_INCREMENT_NEEDED
         INS_READ_NEEDED
 
+        /* The loop is never entered. */
+        if (state->value_known && !state->value)
+            break;
+
+        if (!state->nonzero) {
+            if (!state->flags_valid)
+                buffer->length += sprintf(buffer->data + buffer->length,
+                    "cmp %s, 0\n",
+                    settings.operation_register);
+            buffer->length += sprintf(buffer->data + buffer->length,
+                "je map%zu\n",
+                state->labels);
+        }
+
         buffer->length += sprintf(buffer->data + buffer->length,
-            "cmp %s, 0\n"
-            "je endloop%" PRId64 "\n"
-            "loop%" PRId64 ":\n",
-            settings.operation_register,
-            instruction->value, instruction->value);
+            "mov dil, %" PRIu64 "\n"
+            "mov sil, %d\n"
+            "call bf_map_loop\n"
+            "map%zu:\n",
+            (uint64_t)instruction->value & 0xff,
+            instruction->type == INS_MAP_INPUT_OUTPUT,
+            state->labels++);
+
+        /* The cell is 0 after the loop, but it's only in the register. */
+        state->write_needed = 1;
+        state->flags_valid = 0;
+        state->value_known = 1;
+        state->value = 0;
+        state->nonzero = 0;
         break;
-    case 6:
+    case INS_LOOP_START:
+        /* Start loop, lea of the step counter keeps the flags. */
+        INS_WRITE_NEEDED
+        INS_INCREMENT_NEEDED
+        INS_READ_NEEDED
+        INS_STEPS_NEEDED
+
+        if (state->value_known && !state->value) {
+            /* The loop is never entered. */
+            buffer->length += sprintf(buffer->data + buffer->length,
+                "jmp endloop%" PRId64 "\n"
+                "loop%" PRId64 ":\n",
+                instruction->value, instruction->value);
+            state->flags_valid = 0;
+        } else if (state->nonzero) {
+            /* The loop is always entered, so it's only tested at the end. */
+            buffer->length += sprintf(buffer->data + buffer->length,
+                "loop%" PRId64 ":\n",
+                instruction->value);
+        } else {
+            if (!state->flags_valid)
+                buffer->length += sprintf(buffer->data + buffer->length,
+                    "cmp %s, 0\n",
+                    settings.operation_register);
+
+            buffer->length += sprintf(buffer->data + buffer->length,
+                "je endloop%" PRId64 "\n"
+                "loop%" PRId64 ":\n",
+                instruction->value, instruction->value);
+            state->flags_valid = 1;
+        }
+
+        if (settings.debug)
+            write_symbol(buffer, instruction, "loop");
+
+        /* Cell isn't 0 in the loop body, but its value differs between iterations. */
+        state->value_known = 0;
+        state->nonzero = 1;
+        break;
+    case INS_LOOP_END:
         /* End loop. */
         INS_WRITE_NEEDED
         INS_INCREMENT_NEEDED
         INS_READ_NEEDED
 
-        buffer->length += sprintf(buffer->data + buffer->length,
-            "cmp %s, 0\n"
-            "jne loop%" PRId64 "\n"
-            "endloop%" PRId64 ":\n",
-            settings.operation_register,
-            instruction->value, instruction->value);
+        /* Tests of loops are counted in rbx for --introspect, lea keeps the flags. */
+        if (introspect && !(state->value_known && !state->value))
+            buffer->length += sprintf(buffer->data + buffer->length,
+                "lea rbx, [rbx + 1]\n");
+
+        /* Budgets are checked only at back-edges, straight code can't run for long. */
+        if (limits && !(state->value_known && !state->value)) {
+            buffer->length += sprintf(buffer->data + buffer->length,
+                "sub rbp, %zu\n"
+                "js bf_limit_steps\n",
+                state->steps);
+            state->steps = 0;
+            state->flags_valid = 0;
+        }
+        INS_STEPS_NEEDED
+
+        if (state->value_known && !state->value) {
+            /* The loop always ends here. */
+            buffer->length += sprintf(buffer->data + buffer->length,
+                "endloop%" PRId64 ":\n",
+                instruction->value);
+            state->flags_valid = 0;
+        } else if (state->nonzero) {
+            /* The loop never ends here. */
+            buffer->length += sprintf(buffer->data + buffer->length,
+                "jmp loop%" PRId64 "\n"
+                "endloop%" PRId64 ":\n",
+                instruction->value, instruction->value);
+            state->flags_valid = 0;
+        } else {
+            if (!state->flags_valid)
+                buffer->length += sprintf(buffer->data + buffer->length,
+                    "cmp %s, 0\n",
+                    settings.operation_register);
+
+            buffer->length += sprintf(buffer->data + buffer->length,
+                "jne loop%" PRId64 "\n"
+                "endloop%" PRId64 ":\n",
+                instruction->value, instruction->value);
+            state->flags_valid = 1;
+        }
+
+        if (settings.debug)
+            write_symbol(buffer, instruction, "endloop");
+
+        /* Loop ends only when the cell is 0. */
+        state->value_known = 1;
+        state->value = 0;
+        state->nonzero = 0;
         break;
     }
 }
 
-char *compile(char *code)
+/*
+ * Checks if the loop starting at start is an "if" loop `[ ... [-] ]`,
+ * which runs at most once, because it ends by clearing the loop cell,
+ * and otherwise only adds to and sets at most IF_MAX_CELLS other cells.
+ *
+ * @param   updates Array of IF_MAX_CELLS elements receiving changes of the other cells.
+ * @return          Number of updated cells, -1 if the loop doesn't match.
+ */
+static int if_loop(Program *program, size_t start, IfUpdate *updates)
 {
-    if (code == NULL) {
-        errno = EINVAL;
-        return NULL;
+    size_t stack_bytes = settings.stack_size * settings.cell_size;
+    if (stack_bytes > INT32_MAX)
+        return -1;
+
+    int count = 0;
+    size_t offset = 0;
+    size_t i;
+
+    for (i = start + 1; i < program->length && program->data[i].type != INS_LOOP_END; ++i) {
+        Instruction *instruction = &program->data[i];
+
+        if (instruction->type == INS_MOVE) {
+            int64_t cells = instruction->value % (int64_t)settings.stack_size;
+            offset = (offset + (cells < 0 ? cells + settings.stack_size : cells) * settings.cell_size)
+                % stack_bytes;
+            continue;
+        }
+
+        if (instruction->type != INS_ADD && instruction->type != INS_SET)
+            return -1;
+
+        /* The loop cell is cleared at the end anyway. */
+        if (!offset)
+            continue;
+
+        int k = 0;
+        while (k < count && updates[k].offset != offset)
+            ++k;
+
+        if (k == count) {
+            if (count == IF_MAX_CELLS)
+                return -1;
+            updates[count++] = (IfUpdate) { .offset = offset, .type = instruction->type, .value = 0 };
+        }
+
+        if (instruction->type == INS_SET) {
+            updates[k].type = INS_SET;
+            updates[k].value = instruction->value;
+        } else {
+            updates[k].value += instruction->value;
+        }
+    }
+
+    Instruction *last = &program->data[i - 1];
+    if (i == program->length || i == start + 1 || offset
+        || last->type != INS_SET || ((uint64_t)last->value & cell_mask()))
+        return -1;
+
+    return count;
+}
+
+/*
+ * Writes an "if" loop without branches.
+ *
+ * A mask of the condition is computed from the loop cell
+ * and the changes of the other cells are applied through it,
+ * so the result doesn't depend on predicting the branch.
+ * The loop cell is 0 afterwards either way.
+ *
+ * In case of allocation error frees the buffer and writes ENOMEM to errno.
+ */
+static void write_if_loop(CompileBuffer *buffer, CodeState *state, IfUpdate *updates, int count)
+{
+    reserve_buffer(buffer, 255 + count * 255);
+    if (errno)
+        return;
+
+    static const char *scratch[] = { "cl", "cx", "ecx", "rcx" };
+    static const char *masks[] = { "al", "ax", "eax", "rax" };
+    int size = settings.cell_size == 1 ? 0 : settings.cell_size == 2 ? 1 : settings.cell_size == 4 ? 2 : 3;
+
+    INS_WRITE_NEEDED
+    INS_INCREMENT_NEEDED
+    INS_READ_NEEDED
+
+    if (!state->flags_valid)
+        buffer->length += sprintf(buffer->data + buffer->length,
+            "cmp %s, 0\n",
+            settings.operation_register);
+
+    buffer->length += sprintf(buffer->data + buffer->length,
+        "setnz al\n"
+        "movzx eax, al\n"
+        "neg rax\n");
+
+    for (int k = 0; k < count; ++k) {
+        uint64_t value = updates[k].value & cell_mask();
+
+        /* Offset of the cell wrapped around the stack. */
+        buffer->length += sprintf(buffer->data + buffer->length,
+            "mov rdx, r13\n"
+            "add rdx, %zu\n"
+            "mov rcx, rdx\n"
+            "sub rcx, %zu\n"
+            "cmovae rdx, rcx\n"
+            "mov %s, %" PRIu64 "\n",
+            updates[k].offset,
+            settings.stack_size * settings.cell_size,
+            scratch[size], value);
+
+        if (updates[k].type == INS_SET)
+            buffer->length += sprintf(buffer->data + buffer->length,
+                "xor %s, %s [r15 + rdx]\n"
+                "and %s, %s\n"
+                "xor %s [r15 + rdx], %s\n",
+                scratch[size], data_unit,
+                scratch[size], masks[size],
+                data_unit, scratch[size]);
+        else
+            buffer->length += sprintf(buffer->data + buffer->length,
+                "and %s, %s\n"
+                "add %s [r15 + rdx], %s\n",
+                scratch[size], masks[size],
+                data_unit, scratch[size]);
     }
 
+    buffer->length += sprintf(buffer->data + buffer->length,
+        "mov %s, 0\n",
+        settings.operation_register);
+
+    state->read_needed = 0;
+    state->write_needed = 1;
+    state->flags_valid = 0;
+    state->value_known = 1;
+    state->value = 0;
+    state->nonzero = 0;
+}
+
+/*
+ * Checks if the loop starting at start is a scan loop `[>]` or `[<]`
+ * that can be written as a call of a kernel.
+ * Scans aren't used with --introspect, which counts every test of the loop,
+ * and with budgets, which must stop scans of a stack without zeros.
+ *
+ * @return          1 for `[>]`, -1 for `[<]` and 0 if the loop doesn't match.
+ */
+static int scan_loop(Program *program, size_t start)
+{
+    if (settings.cell_size != 1 || introspect || limits || start + 2 >= program->length
+        || program->data[start].type != INS_LOOP_START
+        || program->data[start + 1].type != INS_MOVE
+        || program->data[start + 2].type != INS_LOOP_END)
+        return 0;
+
+    int64_t value = program->data[start + 1].value;
+    return value == 1 || value == -1 ? (int)value : 0;
+}
+
+/*
+ * Writes a scan loop as a call of the kernel selected by settings.march.
+ * The cell is 0 afterwards, both in memory and in the register.
+ *
+ * In case of allocation error frees the buffer and writes ENOMEM to errno.
+ */
+static void write_scan_loop(CompileBuffer *buffer, CodeState *state, int direction)
+{
+    reserve_buffer(buffer, 255);
+    if (errno)
+        return;
+
+    /* Kernels read the stack from memory. */
+    INS_WRITE_NEEDED
+
+    buffer->length += sprintf(buffer->data + buffer->length,
+        "mov rcx, %zu\n",
+        settings.stack_size * settings.cell_size);
+
+    const char *kernel = scan_kernels[(int)settings.march];
+    if (kernel)
+        buffer->length += sprintf(buffer->data + buffer->length,
+            "call bf_scan_%s_%s\n",
+            direction > 0 ? "right" : "left", kernel);
+    else if (settings.emit == EMIT_OBJECT)
+        buffer->length += sprintf(buffer->data + buffer->length,
+            "call qword%s [rbx + %d]\n",
+            syntax->pointer, OBJECT_SCAN_KERNELS + (direction > 0 ? 0 : 8));
+    else
+        buffer->length += sprintf(buffer->data + buffer->length,
+            "call qword%s [bf_scan_kernels + %d]\n",
+            syntax->pointer, direction > 0 ? 0 : 8);
+
+    buffer->length += sprintf(buffer->data + buffer->length,
+        "mov %s, 0\n",
+        settings.operation_register);
+
+    state->read_needed = 0;
+    state->write_needed = 0;
+    state->increment_needed = 1;
+    state->flags_valid = 0;
+    state->value_known = 1;
+    state->value = 0;
+    state->nonzero = 0;
+}
+
+/*
+ * Checks if the loop starting at start can be memoized:
+ * it contains other loops, but no input or output,
+ * and every loop in it ends at the cell where it started,
+ * so the loop only touches cells at fixed offsets from the loop cell.
+ *
+ * @param   first   Receives offset of the first touched cell in cells.
+ * @return          Number of touched cells, 0 if the loop can't be memoized.
+ */
+static size_t memo_loop(Program *program, size_t start, int64_t *first)
+{
+    int64_t starts[MEMO_MAX_DEPTH];
+    size_t depth = 0;
+    int64_t offset = 0;
+    int64_t low = 0;
+    int64_t high = 0;
+    char nested = 0;
+
+    for (size_t i = start; i < program->length; ++i) {
+        Instruction *instruction = &program->data[i];
+
+        switch (instruction->type) {
+        case INS_MOVE:
+            if (instruction->value > MEMO_MAX_WINDOW || instruction->value < -MEMO_MAX_WINDOW)
+                return 0;
+            offset += instruction->value;
+            break;
+        case INS_ADD:
+        case INS_SET:
+            break;
+        case INS_LOOP_START:
+            if (depth == MEMO_MAX_DEPTH)
+                return 0;
+            nested |= depth > 0;
+            starts[depth++] = offset;
+            break;
+        case INS_LOOP_END:
+            if (starts[--depth] != offset)
+                return 0;
+            break;
+        default:
+            return 0;
+        }
+
+        low = offset < low ? offset : low;
+        high = offset > high ? offset : high;
+        if ((size_t)(high - low + 1) * settings.cell_size > MEMO_MAX_WINDOW)
+            return 0;
+
+        if (!depth)
+            break;
+    }
+
+    /* The window has to fit in the stack without wrapping around. */
+    size_t cells = high - low + 1;
+    if (!nested || cells > settings.stack_size)
+        return 0;
+
+    *first = low;
+    return cells;
+}
+
+/*
+ * Writes lookup of a memoized loop in its cache before the loop.
+ *
+ * Cells at the same offsets are passed to the runtime when the window
+ * doesn't wrap around the stack, otherwise the loop just runs.
+ * On a hit the window is replaced by the cached state and the loop is skipped.
+ *
+ * In case of allocation error frees the buffer and writes ENOMEM to errno.
+ */
+static void write_memo_start(CompileBuffer *buffer, CodeState *state, Instruction *instruction)
+{
+    reserve_buffer(buffer, 1023);
+    if (errno)
+        return;
+
+    size_t stack_bytes = settings.stack_size * settings.cell_size;
+    size_t window = memo.cells * settings.cell_size;
+    size_t entry = 8 + 2 * ((window + 7) & ~(size_t)7);
+    char name[32];
+    sprintf(name, "bf_memo%" PRId64, instruction->value);
+
+    /* Pointer to the entry being filled followed by the entries. */
+    buffer->length += sprintf(buffer->data + buffer->length, "%s", syntax->bss);
+    buffer->length += sprintf(buffer->data + buffer->length, syntax->reserve, name,
+        8 + MEMO_ENTRIES * entry);
+    buffer->length += sprintf(buffer->data + buffer->length, "%s", syntax->text);
+
+    INS_WRITE_NEEDED
+    INS_INCREMENT_NEEDED
+    INS_READ_NEEDED
+    INS_STEPS_NEEDED
+
+    if (!state->nonzero) {
+        if (!state->flags_valid)
+            buffer->length += sprintf(buffer->data + buffer->length,
+                "cmp %s, 0\n",
+                settings.operation_register);
+        buffer->length += sprintf(buffer->data + buffer->length,
+            "je memoend%zu\n",
+            memo.label);
+    }
+
+    if (memo.first < 0)
+        buffer->length += sprintf(buffer->data + buffer->length,
+            "cmp r13, %" PRId64 "\n"
+            "jb memoskip%zu\n",
+            -memo.first * (int64_t)settings.cell_size, memo.label);
+
+    buffer->length += sprintf(buffer->data + buffer->length,
+        "mov rax, %zu\n"
+        "cmp r13, rax\n"
+        "ja memoskip%zu\n"
+        "lea rdi, [r14 %+" PRId64 "]\n"
+        "lea rsi, [%s]\n"
+        "mov edx, %zu\n"
+        "mov ecx, %zu\n"
+        "call bf_memo_find\n"
+        "test eax, eax\n"
+        "jz memorun%zu\n"
+        "mov %s, 0\n"
+        "jmp memoend%zu\n"
+        "memoskip%zu:\n"
+        "xor eax, eax\n"
+        "mov [%s], rax\n"
+        "memorun%zu:\n",
+        stack_bytes - (memo.first + (int64_t)memo.cells) * settings.cell_size, memo.label,
+        memo.first * (int64_t)settings.cell_size, name, window, entry,
+        memo.label, settings.operation_register, memo.label, memo.label, name, memo.label);
+
+    /* The loop is entered with the cell loaded. */
+    state->flags_valid = 0;
+    state->value_known = 0;
+    state->nonzero = 1;
+}
+
+/*
+ * Writes saving of the state after a memoized loop to its cache.
+ *
+ * In case of allocation error frees the buffer and writes ENOMEM to errno.
+ */
+static void write_memo_end(CompileBuffer *buffer, CodeState *state)
+{
+    reserve_buffer(buffer, 255);
+    if (errno)
+        return;
+
+    size_t window = memo.cells * settings.cell_size;
+
+    /* The cells are in memory after the loop end and the pointer is where the loop started. */
+    buffer->length += sprintf(buffer->data + buffer->length,
+        "lea rdi, [r14 %+" PRId64 "]\n"
+        "lea rsi, [bf_memo%" PRId64 "]\n"
+        "mov edx, %zu\n"
+        "mov ecx, %zu\n"
+        "call bf_memo_store\n"
+        "memoend%zu:\n",
+        memo.first * (int64_t)settings.cell_size, memo.value, window,
+        8 + 2 * ((window + 7) & ~(size_t)7), memo.label);
+
+    state->flags_valid = 0;
+}
+
+/*
+ * Writes instruction at index i, or the whole loop starting there
+ * if it's a scan loop or an "if" loop that can be written without branches.
+ * Loops are memoized with settings.memoize when they can be.
+ *
+ * @return          Number of written instructions.
+ */
+static size_t write_code(CompileBuffer *buffer, CodeState *state, Program *program, size_t i)
+{
+    IfUpdate updates[IF_MAX_CELLS];
+    int count;
+
+    /* Loops that are never entered are left to write_instruction, which jumps over them. */
+    int direction = scan_loop(program, i);
+    if (direction && !(state->value_known && !state->value)) {
+        write_scan_loop(buffer, state, direction);
+        ++stats.optimizations[OPT_SCAN];
+        return 3;
+    }
+
+    /* Loops that are never entered or always entered have no branches to remove. */
+    if (program->data[i].type == INS_LOOP_START && !state->value_known && !state->nonzero
+        && (count = if_loop(program, i, updates)) >= 0) {
+        write_if_loop(buffer, state, updates, count);
+        ++stats.optimizations[OPT_BRANCHLESS];
+        state->steps += loop_end(program, i) - i + 1;
+        return loop_end(program, i) - i + 1;
+    }
+
+    /* Only the outermost loop is memoized, loops that are never entered aren't. */
+    Instruction *instruction = &program->data[i];
+    if (instruction->type == INS_LOOP_START && settings.memoize && settings.emit != EMIT_OBJECT
+        && memo.end == SIZE_MAX && !(state->value_known && !state->value)
+        && (memo.cells = memo_loop(program, i, &memo.first))) {
+        memo.end = loop_end(program, i);
+        memo.value = instruction->value;
+        memo.label = state->labels++;
+        write_memo_start(buffer, state, instruction);
+        ++memoized;
+        ++stats.optimizations[OPT_MEMO];
+    }
+
+    write_instruction(buffer, state, instruction);
+
+    if (i == memo.end) {
+        write_memo_end(buffer, state);
+        memo.end = SIZE_MAX;
+    }
+    return 1;
+}
+
+char *compile(char *code)
+{
     errno = 0;
 
+    /* Parse and optimize brainfuck code. */
+    Program *program = parse_program(code);
+    if (!program)
+        return NULL;
+
+    program = optimize(program);
+    if (!program)
+        return NULL;
+
     /* Initialize buffer for compiled code. */
     CompileBuffer buffer;
     buffer.size = 8192;
     buffer.length = 0;
     buffer.data = malloc(buffer.size);
 
-    MEMERRN(buffer.data)
+    if (!buffer.data) {
+        free_program(program);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    syntax = settings.assembler == ASSEMBLER_GAS ? &gas_syntax : &nasm_syntax;
+    memo.end = SIZE_MAX;
+    memoized = 0;
+    introspect = settings.introspect && settings.emit != EMIT_OBJECT;
+    limits = settings.max_steps || settings.max_output || settings.max_time;
+    positions = 0;
+    sprintf(data_unit, "%s%s", settings.data_unit, syntax->pointer);
 
     /*
      * Write beginning of the code to the buffer.
-     * Allocates an array of size settings.stack_size and initializes it to 0.
+     * Allocates an array of size settings.stack_size and stores its address in r15.
+     * Memory from .bss and mmap is already zeroed and is committed only when it's touched.
      * Initializes stack pointer r13 to 0.
      */
-    buffer.length += sprintf(buffer.data,
-        "section .bss\n"
-        "stack res%c %zu\n"
-        "section .text\n"
-        "global _start\n"
-        "_start:\n"
-        "mov rdi, stack\n"
-        "mov rcx, %zu\n"
-        "xor %s, %s\n"
-        "rep stos%c\n"
+    size_t stack_bytes = settings.stack_size * settings.cell_size;
+    char object = settings.emit == EMIT_OBJECT;
+    char tape = settings.tape;
+    if (tape == TAPE_AUTO)
+        tape = stack_bytes > TAPE_BSS_LIMIT ? TAPE_MMAP : TAPE_BSS;
+
+    reserve_buffer(&buffer, strlen(settings.input_file) + 64);
+    if (errno) {
+        free_program(program);
+        return NULL;
+    }
+    buffer.length += sprintf(buffer.data, "%s", syntax->header);
+    if (settings.debug)
+        buffer.length += sprintf(buffer.data + buffer.length, syntax->file, settings.input_file);
+    buffer.length += sprintf(buffer.data + buffer.length, "%s", syntax->text);
+    buffer.length += sprintf(buffer.data + buffer.length, syntax->global, object ? "bf_main" : "_start",
+        object ? "bf_main" : "_start");
+    if (introspect)
+        buffer.length += sprintf(buffer.data + buffer.length, "%sbf_positions:\n%s",
+            syntax->rodata, syntax->text);
+
+    if (object) {
+        /*
+         * int bf_main(bf_io *io, void *tape, size_t tape_len)
+         * Saves registers that belong to the caller, keeps state in a frame
+         * on the stack addressed by rbx and clears the tape passed by the caller.
+         */
+        buffer.length += sprintf(buffer.data + buffer.length,
+            "bf_main:\n"
+            "push rbx\n"
+            "push rbp\n"
+            "push r12\n"
+            "push r13\n"
+            "push r14\n"
+            "push r15\n"
+            "sub rsp, %d\n"
+            "mov rbx, rsp\n"
+            "mov [rbx + %d], rdi\n"
+            "xor eax, eax\n"
+            "mov [rbx + %d], rax\n"
+            "mov [rbx + %d], rax\n"
+            "mov [rbx + %d], rax\n"
+            "mov eax, %d\n"
+            "mov rcx, %zu\n"
+            "cmp rdx, rcx\n"
+            "jb bf_return\n"
+            "mov r15, rsi\n"
+            "mov rdi, rsi\n"
+            "xor eax, eax\n"
+            "rep stosb\n",
+            OBJECT_FRAME_SIZE, OBJECT_IO, OBJECT_IN_POS, OBJECT_IN_LEN, OBJECT_OUT_LEN,
+            BF_ERROR_TAPE, stack_bytes);
+        tape = -1;
+    } else {
+        buffer.length += sprintf(buffer.data + buffer.length,
+            "_start:\n");
+    }
+
+    switch (tape) {
+    case TAPE_BSS:
+        /* The stack itself is reserved with the other data at the end. */
+        buffer.length += sprintf(buffer.data + buffer.length,
+            "lea r15, [stack]\n");
+        break;
+    case TAPE_MMAP:
+        /* mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0) */
+        buffer.length += sprintf(buffer.data + buffer.length,
+            "mov rax, 9\n"
+            "xor rdi, rdi\n"
+            "mov rsi, %zu\n"
+            "mov rdx, 3\n"
+            "mov r10, 0x4022\n"
+            "mov r8, -1\n"
+            "xor r9, r9\n"
+            "syscall\n"
+            "cmp rax, -4095\n"
+            "jae bf_tape_error\n"
+            "mov r15, rax\n",
+            stack_bytes);
+        break;
+    case TAPE_HUGE:
+        /*
+         * Try huge pages reserved by the system with MAP_HUGETLB first,
+         * without MAP_NORESERVE so that mmap fails instead of raising SIGBUS
+         * later when there are not enough of them.
+         * Otherwise map 2 MiB more than needed, align the tape to 2 MiB
+         * and ask for transparent huge pages with madvise(MADV_HUGEPAGE).
+         */
+        buffer.length += sprintf(buffer.data + buffer.length,
+            "mov rax, 9\n"
+            "xor rdi, rdi\n"
+            "mov rsi, %zu\n"
+            "mov rdx, 3\n"
+            "mov r10, 0x40022\n"
+            "mov r8, -1\n"
+            "xor r9, r9\n"
+            "syscall\n"
+            "mov r15, rax\n"
+            "cmp rax, -4095\n"
+            "jb bf_tape_ready\n"
+            "mov rax, 9\n"
+            "xor rdi, rdi\n"
+            "mov rsi, %zu\n"
+            "mov rdx, 3\n"
+            "mov r10, 0x4022\n"
+            "mov r8, -1\n"
+            "xor r9, r9\n"
+            "syscall\n"
+            "cmp rax, -4095\n"
+            "jae bf_tape_error\n"
+            "lea r15, [rax + 0x1fffff]\n"
+            "and r15, -0x200000\n"
+            "mov rax, 28\n"
+            "mov rdi, r15\n"
+            "mov rsi, %zu\n"
+            "mov rdx, 14\n"
+            "syscall\n"
+            "bf_tape_ready:\n",
+            (stack_bytes + 0x1fffff) & ~(size_t)0x1fffff,
+            ((stack_bytes + 0x1fffff) & ~(size_t)0x1fffff) + 0x200000,
+            (stack_bytes + 0x1fffff) & ~(size_t)0x1fffff);
+        break;
+    }
+
+    buffer.length += sprintf(buffer.data + buffer.length,
         "xor r13, r13\n"
         "xor %s, %s\n"
-        "mov r14, stack\n",
-        *settings.data_unit, settings.stack_size,
-        settings.stack_size, settings.operation_register,
-        settings.operation_register, *settings.data_unit,
+        "mov r14, r15\n",
         settings.operation_register, settings.operation_register);
 
-    char exit_call[] = "mov rax, 0x3c\n"
-                       "mov rdi, 0\n"
-                       "syscall\n";
+    /* Kernels of scan loops are selected for this processor before they are used. */
+    char uses_scan = 0;
+    for (size_t i = 0; i < program->length && !uses_scan; ++i)
+        uses_scan = scan_loop(program, i) != 0;
+    char dispatch = uses_scan && settings.march == MARCH_DISPATCH;
+    if (dispatch && object)
+        buffer.length += sprintf(buffer.data + buffer.length,
+            "lea rdi, [rbx + %d]\n"
+            "call bf_scan_dispatch\n",
+            OBJECT_SCAN_KERNELS);
+    else if (dispatch)
+        buffer.length += sprintf(buffer.data + buffer.length,
+            "lea rdi, [bf_scan_kernels]\n"
+            "call bf_scan_dispatch\n");
 
-    size_t c = 0;
-    for (size_t i = 0; code[i] != '\0'; ++i)
-        c += code[i] == '[';
+    /* rbx counts tests of loops. */
+    if (introspect)
+        buffer.length += sprintf(buffer.data + buffer.length,
+            "xor ebx, ebx\n"
+            "call bf_introspect_install\n");
 
-    size_t bracket_index = 0; /* Index of the last opened brackets in bracket_labels. */
-    int64_t *bracket_labels = calloc(c, sizeof(int64_t)); /* Numbers assigned to each loop */
-    int64_t label_index = 0; /* Total number of loops so that each label is unique. */
+    /* Both counters are used with any budget, so that the report shows them. */
+    if (limits)
+        buffer.length += sprintf(buffer.data + buffer.length,
+            "mov rbp, %zu\n"
+            "mov rax, %zu\n"
+            "mov [bf_output_left], rax\n",
+            settings.max_steps ? settings.max_steps : (size_t)INT64_MAX,
+            settings.max_output ? settings.max_output : (size_t)INT64_MAX);
 
-    Instruction instruction = {
-        .type = 0,
-        .read_needed = 0,
-        .write_needed = 0,
-        .increment_needed = 0,
-        .value = 0
-    };
+    /* Runs forked from here start with the stack and the state above, timers aren't inherited. */
+    char fork_server = settings.fork_server && !object;
+    if (fork_server)
+        buffer.length += sprintf(buffer.data + buffer.length,
+            "call bf_fork_server\n");
+    if (limits && settings.max_time)
+        buffer.length += sprintf(buffer.data + buffer.length,
+            "mov rdi, %zu\n"
+            "mov rsi, %zu\n"
+            "call bf_limit_timer\n",
+            settings.max_time / 1000, settings.max_time % 1000 * 1000);
 
-#define INS_WRITE                                 \
-    if (instruction.type) {                       \
-        write_instruction(&buffer, &instruction); \
-        if (errno)                                \
-            return NULL;                          \
-    }
+    /* Objects return BF_OK after writing the rest of the output. */
+    const char *exit_call = object
+        ? "call bf_flush\n"
+          "xor eax, eax\n"
+          "jmp bf_return\n"
+        : "mov rax, 0x3c\n"
+          "mov rdi, 0\n"
+          "syscall\n";
 
-    for (; *code != '\0'; ++code) {
-        switch (*code) {
-        case '>': /* Move stack pointer to the right. */
-            if (instruction.type == 1) {
-                ++instruction.value;
-                break;
-            }
+    /*
+     * Write subroutines found by the outliner to a separate buffer,
+     * so that their final state is known at the calls.
+     * The cell may not be written to memory when they are called.
+     */
+    Outline *outline = NULL;
+    CodeState *returns = NULL;
+    CompileBuffer subroutines = { .size = 8192, .length = 0, .data = NULL };
+    size_t labels = 0;
 
-            INS_WRITE
+    if (settings.optimize_size) {
+        outline = outline_program(program);
+        if (outline) {
+            returns = malloc((outline->count + 1) * sizeof(CodeState));
+            subroutines.data = malloc(subroutines.size);
+        }
+        if (!outline || !returns || !subroutines.data) {
+            free_outline(outline);
+            free(returns);
+            free(subroutines.data);
+            free(buffer.data);
+            free_program(program);
+            errno = ENOMEM;
+            return NULL;
+        }
+        subroutines.data[0] = '\0';
 
-            instruction.type = 1;
-            instruction.value = 1;
-            instruction.read_needed = 1;
-            instruction.increment_needed = 1;
+        for (size_t k = 0; k < outline->count && !errno; ++k) {
+            Subroutine *subroutine = &outline->data[k];
+            CodeState *state = &returns[k];
+            *state = (CodeState) { .write_needed = 1, .labels = labels };
+            size_t line = 0;
 
-            break;
-        case '<': /* Move stack pointer to the left. */
-            if (instruction.type == 1) {
-                --instruction.value;
+            reserve_buffer(&subroutines, 64);
+            if (errno)
                 break;
-            }
-
-            INS_WRITE
+            char name[32];
+            sprintf(name, "bf_sub%zu", k);
+            if (settings.debug)
+                subroutines.length += sprintf(subroutines.data + subroutines.length,
+                    syntax->global, name, name);
+            subroutines.length += sprintf(subroutines.data + subroutines.length,
+                "%s:\n", name);
 
-            instruction.type = 1;
-            instruction.value = -1;
-            instruction.read_needed = 1;
-            instruction.increment_needed = 1;
-
-            break;
-        case '+': /* Increase value in a cell pointed to by the stack pointer by value. */
-            if (instruction.type == 2) {
-                ++instruction.value;
-                break;
+            for (size_t i = subroutine->start; i < subroutine->start + subroutine->length && !errno;) {
+                write_line(&subroutines, &program->data[i], &line);
+                if (!errno)
+                    write_position(&subroutines, &program->data[i]);
+                if (!errno)
+                    i += write_code(&subroutines, state, program, i);
             }
 
-            INS_WRITE
+            if (!errno)
+                write_call_state(&subroutines, state);
+            if (!errno)
+                subroutines.length += sprintf(subroutines.data + subroutines.length, "ret\n");
+            labels = state->labels;
+        }
 
-            instruction.type = 2;
-            instruction.value = 1;
-            instruction.write_needed = 1;
+        if (errno) {
+            free_outline(outline);
+            free(returns);
+            free(buffer.data);
+            free_program(program);
+            return NULL;
+        }
+    }
 
-            break;
-        case '-': /* Decrease value in a cell pointed to by the stack pointer by value. */
-            if (instruction.type == 2) {
-                --instruction.value;
-                break;
-            }
+    /* The stack is zeroed, so the first cell is known to be 0. */
+    CodeState state = {
+        .read_needed = 0,
+        .write_needed = 0,
+        .increment_needed = 0,
+        .flags_valid = 0,
+        .value_known = 1,
+        .nonzero = 0,
+        .value = 0,
+        .labels = labels
+    };
 
-            INS_WRITE
+    /* Find which runtime routines are needed. */
+    char uses_input = 0;
+    char uses_map_loop = 0;
+    for (size_t i = 0; i < program->length; ++i) {
+        char type = program->data[i].type;
+        uses_input |= type == INS_INPUT || type == INS_MAP_OUTPUT_INPUT || type == INS_MAP_INPUT_OUTPUT;
+        uses_map_loop |= type == INS_MAP_OUTPUT_INPUT || type == INS_MAP_INPUT_OUTPUT;
+    }
 
-            instruction.type = 2;
-            instruction.value = -1;
-            instruction.write_needed = 1;
+    size_t line = 0;
 
+    for (size_t i = 0; i < program->length && !errno;) {
+        /* Map the following code to the line of the instruction in the source code. */
+        write_line(&buffer, &program->data[i], &line);
+        if (!errno)
+            write_position(&buffer, &program->data[i]);
+        if (errno)
             break;
-        case '.': /* Print character in the cell pointed to by the stack pointer. */
-            INS_WRITE
 
-            instruction.type = 3;
-
-            break;
-        case ',': /* Read character from stdin to the cell pointed to by the stack pointer. */
-            INS_WRITE
+        if (outline && outline->calls[i]) {
+            /* Call the subroutine instead of its sequence. */
+            size_t k = outline->calls[i] - 1;
+            write_call_state(&buffer, &state);
+            if (errno)
+                break;
+            buffer.length += sprintf(buffer.data + buffer.length, "call bf_sub%zu\n", k);
 
-            instruction.type = 4;
-            instruction.read_needed = 1;
-            instruction.write_needed = 0;
+            size_t used_labels = state.labels;
+            state = returns[k];
+            state.labels = used_labels;
+            i += outline->data[k].length;
+            continue;
+        }
 
-            break;
-        case '[': /* Start loop. */
-            INS_WRITE
+        i += write_code(&buffer, &state, program, i);
+    }
 
-            instruction.type = 5;
-            instruction.value = label_index;
+    free_program(program);
+    free_outline(outline);
+    free(returns);
 
-            bracket_labels[bracket_index++] = label_index++;
+    if (errno) {
+        free(subroutines.data);
+        return NULL;
+    }
 
-            break;
-        case ']': /* End loop. */
-            INS_WRITE
+    /* Make sure the buffer is large enough for the exit call, runtime routines and their data. */
+    reserve_buffer(&buffer, strlen(exit_call) + subroutines.length + strlen(runtime_tape_error)
+            + strlen(runtime_object) + strlen(runtime_io) + strlen(runtime_map_loop)
+            + strlen(runtime_memo) + strlen(runtime_introspect) + strlen(settings.introspect_file)
+            + strlen(runtime_scan_sse2) + strlen(runtime_scan_avx2) + strlen(runtime_scan_avx512)
+            + strlen(runtime_scan_dispatch) + strlen(runtime_number) + strlen(runtime_limit)
+            + strlen(runtime_fork_server) + 1024);
+    if (errno) {
+        free(subroutines.data);
+        return NULL;
+    }
 
-            instruction.type = 6;
-            instruction.value = bracket_labels[--bracket_index];
+    /* Write exit syscall to buffer, reporting the caches of memoized loops first. */
+    char uses_memo = memoized > 0;
+    if (uses_memo)
+        buffer.length += sprintf(buffer.data + buffer.length, "call bf_memo_report\n");
+    buffer.length += sprintf(buffer.data + buffer.length, "%s", exit_call);
 
-            break;
-        }
+    if (subroutines.data) {
+        buffer.length += sprintf(buffer.data + buffer.length, "%s", subroutines.data);
+        free(subroutines.data);
     }
 
-    /* Check if there was any brainfuck code and return error. */
-    INS_WRITE
-    else errno = ENOCODE;
+    /* Code after the last entry belongs to runtime routines, which have no position. */
+    if (introspect)
+        buffer.length += sprintf(buffer.data + buffer.length,
+            "bf_pos_runtime:\n"
+            "%s"
+            "%s bf_pos_runtime, 0, 0\n"
+            "bf_positions_end:\n"
+            "%s"
+            "%s",
+            syntax->rodata, syntax->quad, syntax->text, runtime_introspect);
 
-    /* Check if brackets are closed and return error. */
-    if (bracket_index)
-        errno = EUNCLOSED;
+    if (tape == TAPE_MMAP || tape == TAPE_HUGE)
+        buffer.length += sprintf(buffer.data + buffer.length, "%s", runtime_tape_error);
 
-    free(bracket_labels);
+    if (object)
+        buffer.length += sprintf(buffer.data + buffer.length, "%s", runtime_object);
+    else if (uses_input)
+        buffer.length += sprintf(buffer.data + buffer.length, "%s", runtime_io);
+    if (uses_map_loop)
+        buffer.length += sprintf(buffer.data + buffer.length, "%s", runtime_map_loop);
+    if (uses_memo || limits)
+        buffer.length += sprintf(buffer.data + buffer.length, "%s", runtime_number);
+    if (uses_memo)
+        buffer.length += sprintf(buffer.data + buffer.length, "%s", runtime_memo);
+    if (limits)
+        buffer.length += sprintf(buffer.data + buffer.length, "%s", runtime_limit);
+    if (fork_server)
+        buffer.length += sprintf(buffer.data + buffer.length, "%s", runtime_fork_server);
+    if (uses_scan && (dispatch || settings.march == MARCH_X86_64))
+        buffer.length += sprintf(buffer.data + buffer.length, "%s", runtime_scan_sse2);
+    if (uses_scan && (dispatch || settings.march == MARCH_V3))
+        buffer.length += sprintf(buffer.data + buffer.length, "%s", runtime_scan_avx2);
+    if (uses_scan && (dispatch || settings.march == MARCH_V4))
+        buffer.length += sprintf(buffer.data + buffer.length, "%s", runtime_scan_avx512);
+    if (dispatch)
+        buffer.length += sprintf(buffer.data + buffer.length, "%s", runtime_scan_dispatch);
 
-    /* Make sure the buffer is large enough for the exit call */
-    if (buffer.length + sizeof(exit_call) > buffer.size) {
-        buffer.size += sizeof(exit_call);
-        char *tmp = realloc(buffer.data, buffer.size);
-        MEMERRNF(tmp, buffer.data)
-        buffer.data = tmp;
+    /* Data of the stack and runtime routines. */
+    if (tape == TAPE_MMAP || tape == TAPE_HUGE || uses_memo || introspect || limits)
+        buffer.length += sprintf(buffer.data + buffer.length, "%s", syntax->rodata);
+    if (tape == TAPE_MMAP || tape == TAPE_HUGE)
+        buffer.length += sprintf(buffer.data + buffer.length, syntax->string,
+            "bf_tape_message", TAPE_ERROR_MESSAGE);
+    if (uses_memo) {
+        buffer.length += sprintf(buffer.data + buffer.length, syntax->ascii,
+            "bf_memo_hits_text", MEMO_HITS_TEXT);
+        buffer.length += sprintf(buffer.data + buffer.length, syntax->ascii,
+            "bf_memo_misses_text", MEMO_MISSES_TEXT);
+    }
+    if (introspect) {
+        buffer.length += sprintf(buffer.data + buffer.length, syntax->string,
+            "bf_introspect_format", INTROSPECT_FORMAT);
+        buffer.length += sprintf(buffer.data + buffer.length, syntax->asciz,
+            "bf_introspect_path", settings.introspect_file);
+        buffer.length += sprintf(buffer.data + buffer.length, "bf_cell_size:\n%s %zu\n",
+            syntax->quad, settings.cell_size);
     }
+    if (limits) {
+        buffer.length += sprintf(buffer.data + buffer.length, syntax->string,
+            "bf_limit_steps_text", LIMIT_STEPS_TEXT);
+        buffer.length += sprintf(buffer.data + buffer.length, syntax->string,
+            "bf_limit_output_text", LIMIT_OUTPUT_TEXT);
+        buffer.length += sprintf(buffer.data + buffer.length, syntax->string,
+            "bf_limit_time_text", LIMIT_TIME_TEXT);
+        buffer.length += sprintf(buffer.data + buffer.length, syntax->ascii,
+            "bf_limit_steps_label", LIMIT_STEPS_LABEL);
+        buffer.length += sprintf(buffer.data + buffer.length, syntax->ascii,
+            "bf_limit_output_label", LIMIT_OUTPUT_LABEL);
+        buffer.length += sprintf(buffer.data + buffer.length, "bf_limit_budget:\n%s %zu, %zu\n",
+            syntax->quad, settings.max_steps ? settings.max_steps : (size_t)INT64_MAX,
+            settings.max_output ? settings.max_output : (size_t)INT64_MAX);
+    }
+    if (uses_memo || introspect || limits)
+        buffer.length += sprintf(buffer.data + buffer.length, "%s", syntax->bss);
+    for (const RuntimeData *data = runtime_memo_data; data->name && uses_memo; ++data)
+        buffer.length += sprintf(buffer.data + buffer.length, syntax->reserve, data->name, data->size);
+    for (const RuntimeData *data = runtime_introspect_data; data->name && introspect; ++data)
+        buffer.length += sprintf(buffer.data + buffer.length, syntax->reserve, data->name, data->size);
+    for (const RuntimeData *data = runtime_limit_data; data->name && limits; ++data)
+        buffer.length += sprintf(buffer.data + buffer.length, syntax->reserve, data->name, data->size);
+    if (dispatch && !object) {
+        buffer.length += sprintf(buffer.data + buffer.length, "%s", syntax->bss);
+        buffer.length += sprintf(buffer.data + buffer.length, syntax->reserve, "bf_scan_kernels", (size_t)16);
+    }
+    if (tape == TAPE_BSS || (!object && uses_input)) {
+        buffer.length += sprintf(buffer.data + buffer.length, "%s", syntax->bss);
+        if (tape == TAPE_BSS)
+            buffer.length += sprintf(buffer.data + buffer.length, syntax->reserve, "stack", stack_bytes);
+        for (const RuntimeData *data = runtime_io_data; data->name && !object && uses_input; ++data)
+            buffer.length += sprintf(buffer.data + buffer.length, syntax->reserve, data->name, data->size);
+    }
+    buffer.length += sprintf(buffer.data + buffer.length, "%s", syntax->stack_note);
 
-    /* Write exit syscall to buffer. */
-    buffer.length += sprintf(buffer.data + buffer.length, "%s", exit_call);
+    stats.assembly_bytes = buffer.length;
 
     return buffer.data;
 };
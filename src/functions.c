@@ -1,9 +1,11 @@
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #include "functions.h"
 #include "settings.h"
+#include "stats.h"
 
 /*
  * Parses string to size_t.
@@ -50,7 +52,24 @@ int help(size_t argc, char **argv)
            "  --output_file <file>  -o  -- Sets output file.\n"
            "  --stack_size <value>  -s  -- Sets length of the stack.\n"
            "  --cell_size <value>   -c  -- Sets cell size. (Accepts 1, 2, 4 or 8 bytes)\n"
-           "  --assembly            -S  -- Outputs assembly instead of an executable.\n");
+           "  --assembly            -S  -- Outputs assembly instead of an executable.\n"
+           "  --emit <type>             -- Sets type of the output. (Accepts executable, assembly or object)\n"
+           "  --assembler <name>        -- Sets assembler of the output. (Accepts nasm or gas)\n"
+           "  --march <level>           -- Sets instruction sets of kernels. (x86-64, v3, v4, native or dispatch)\n"
+           "  --stats[=json]            -- Prints build statistics to stderr.\n"
+           "  --debug               -g  -- Adds symbols and line information for debuggers and profilers.\n"
+           "  --tape <type>             -- Sets how the stack is allocated. (auto, bss, mmap or huge)\n"
+           "  --optimize <goal>     -O  -- Optimizes for speed or size. (Accepts speed or size, -Os for size)\n"
+           "  --memoize                 -- Caches results of loops without input or output. (Reports hits at exit)\n"
+           "  --introspect[=file]       -- Reports position and counters on SIGUSR1 to stderr or the file.\n"
+           "  --max_steps <count>       -- Stops executables after this many optimized instructions, not commands. (Defaults to 0, unlimited)\n"
+           "  --max_output <bytes>      -- Stops executables before writing more output. (Defaults to 0, unlimited)\n"
+           "  --max_time <ms>           -- Stops executables after this many milliseconds. (Defaults to 0, unlimited)\n"
+           "  --fork_server             -- Makes executables run once per request of a runner, forked after starting.\n"
+           "  --serve <socket>          -- Runs a compile server listening on the socket.\n"
+           "  --workers <count>         -- Sets number of workers of the server. (Defaults to number of processors)\n"
+           "  --run                 -r  -- Runs the program instead of building it, compiling hot loops.\n"
+           "  --jit_threshold <count>   -- Sets iterations after which loops are compiled by --run. (Defaults to 1000, 0 interprets only)\n");
     exit(0);
     return 0;
 }
@@ -149,7 +168,277 @@ int output_file(size_t argc, char **argv)
  */
 int assembly(size_t argc, char **argv)
 {
-    settings.assembly = 1;
+    settings.emit = EMIT_ASSEMBLY;
+    return 0;
+}
+
+/*
+ * Sets type of the output file.
+ */
+int emit(size_t argc, char **argv)
+{
+    if (!argc)
+        die("Output type not provided.");
+    if (strcmp(argv[0], "executable") == 0)
+        settings.emit = EMIT_EXECUTABLE;
+    else if (strcmp(argv[0], "assembly") == 0)
+        settings.emit = EMIT_ASSEMBLY;
+    else if (strcmp(argv[0], "object") == 0)
+        settings.emit = EMIT_OBJECT;
+    else
+        die("Output type must be `executable`, `assembly` or `object`.");
+    return 0;
+}
+
+/*
+ * Sets assembler used to build objects and executables.
+ */
+int assembler(size_t argc, char **argv)
+{
+    if (!argc)
+        die("Assembler not provided.");
+    if (strcmp(argv[0], "nasm") == 0)
+        settings.assembler = ASSEMBLER_NASM;
+    else if (strcmp(argv[0], "gas") == 0 || strcmp(argv[0], "as") == 0)
+        settings.assembler = ASSEMBLER_GAS;
+    else
+        die("Assembler must be `nasm` or `gas`.");
+    return 0;
+}
+
+/*
+ * Sets instruction sets of runtime kernels,
+ * native selects the best level supported by this processor.
+ * There is no x86-64-v2 level, as no kernel uses its instructions.
+ */
+int march(size_t argc, char **argv)
+{
+    if (!argc)
+        die("Architecture level not provided.");
+    /* Levels may be written without the x86-64- prefix. */
+    char *level = strncmp(argv[0], "x86-64-", 7) == 0 ? argv[0] + 7 : argv[0];
+    if (strcmp(level, "x86-64") == 0)
+        settings.march = MARCH_X86_64;
+    else if (strcmp(level, "v3") == 0)
+        settings.march = MARCH_V3;
+    else if (strcmp(level, "v4") == 0)
+        settings.march = MARCH_V4;
+    else if (strcmp(level, "dispatch") == 0)
+        settings.march = MARCH_DISPATCH;
+    else if (strcmp(level, "native") == 0) {
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw"))
+            settings.march = MARCH_V4;
+        else if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("bmi"))
+            settings.march = MARCH_V3;
+        else
+            settings.march = MARCH_X86_64;
+    } else
+        die("Architecture level must be `x86-64`, `x86-64-v3`, `x86-64-v4`, `native` or `dispatch`.");
+    return 0;
+}
+
+/*
+ * Enables build statistics, optionally in JSON format.
+ */
+int statistics(size_t argc, char **argv)
+{
+    if (!argc)
+        settings.stats = STATS_TEXT;
+    else if (strcmp(argv[0], "json") == 0)
+        settings.stats = STATS_JSON;
+    else if (strcmp(argv[0], "text") == 0)
+        settings.stats = STATS_TEXT;
+    else
+        die("Statistics format must be `text` or `json`.");
+    return 0;
+}
+
+/*
+ * Enables debugging information.
+ */
+int debug(size_t argc, char **argv)
+{
+    settings.debug = 1;
+    return 0;
+}
+
+/*
+ * Sets how the stack is allocated.
+ */
+int tape(size_t argc, char **argv)
+{
+    if (!argc)
+        die("Tape type not provided.");
+    if (strcmp(argv[0], "auto") == 0)
+        settings.tape = TAPE_AUTO;
+    else if (strcmp(argv[0], "bss") == 0)
+        settings.tape = TAPE_BSS;
+    else if (strcmp(argv[0], "mmap") == 0)
+        settings.tape = TAPE_MMAP;
+    else if (strcmp(argv[0], "huge") == 0)
+        settings.tape = TAPE_HUGE;
+    else
+        die("Tape type must be `auto`, `bss`, `mmap` or `huge`.");
+    return 0;
+}
+
+/*
+ * Sets if the code should be optimized for speed or size.
+ */
+int optimization_goal(size_t argc, char **argv)
+{
+    if (!argc)
+        die("Optimization goal not provided.");
+    if (strcmp(argv[0], "s") == 0 || strcmp(argv[0], "size") == 0)
+        settings.optimize_size = 1;
+    else if (strcmp(argv[0], "speed") == 0)
+        settings.optimize_size = 0;
+    else
+        die("Optimization goal must be `speed` or `size`.");
+    return 0;
+}
+
+/*
+ * Enables memoization of loops without input or output.
+ */
+int memoize(size_t argc, char **argv)
+{
+    settings.memoize = 1;
+    return 0;
+}
+
+/*
+ * Enables the SIGUSR1 report of executables, optionally appended to a file.
+ */
+int introspect(size_t argc, char **argv)
+{
+    settings.introspect = 1;
+    if (!argc)
+        return 0;
+    if (!*argv[0] || strpbrk(argv[0], "\"\\\n"))
+        die("Introspection file must not be empty or contain quotes, backslashes or newlines.");
+    settings.introspect_file = argv[0];
+    return 0;
+}
+
+/*
+ * Sets number of optimized instructions after which executables stop.
+ */
+int max_steps(size_t argc, char **argv)
+{
+    if (!argc)
+        die("Step limit not provided.");
+
+    char err;
+    size_t limit = parse_size_t(argv[0], &err);
+
+    /* Counters are signed in executables. */
+    if (err || limit > INT64_MAX)
+        die("Step limit must be a number below 2^63.");
+
+    settings.max_steps = limit;
+    return 0;
+}
+
+/*
+ * Sets number of characters executables may write.
+ */
+int max_output(size_t argc, char **argv)
+{
+    if (!argc)
+        die("Output limit not provided.");
+
+    char err;
+    size_t limit = parse_size_t(argv[0], &err);
+
+    if (err || limit > INT64_MAX)
+        die("Output limit must be a number below 2^63.");
+
+    settings.max_output = limit;
+    return 0;
+}
+
+/*
+ * Sets time in milliseconds after which executables stop.
+ */
+int max_time(size_t argc, char **argv)
+{
+    if (!argc)
+        die("Time limit not provided.");
+
+    char err;
+    size_t limit = parse_size_t(argv[0], &err);
+
+    if (err || limit > INT64_MAX)
+        die("Time limit must be a number below 2^63.");
+
+    settings.max_time = limit;
+    return 0;
+}
+
+/*
+ * Makes executables serve runs forked from a single started process.
+ */
+int fork_server(size_t argc, char **argv)
+{
+    settings.fork_server = 1;
+    return 0;
+}
+
+/*
+ * Sets socket of the compile server.
+ */
+int serve_socket(size_t argc, char **argv)
+{
+    if (!argc)
+        die("Socket not provided.");
+    settings.serve = argv[0];
+    return 0;
+}
+
+/*
+ * Sets number of workers of the compile server.
+ */
+int workers(size_t argc, char **argv)
+{
+    if (!argc)
+        die("Number of workers not provided.");
+
+    char err;
+    size_t workers = parse_size_t(argv[0], &err);
+
+    if (err || !workers)
+        die("Number of workers must be a number greater than 0.");
+
+    settings.workers = workers;
+    return 0;
+}
+
+/*
+ * Runs the program instead of building it.
+ */
+int run(size_t argc, char **argv)
+{
+    settings.run = 1;
+    return 0;
+}
+
+/*
+ * Sets number of iterations after which loops are compiled when running.
+ */
+int jit_threshold(size_t argc, char **argv)
+{
+    if (!argc)
+        die("JIT threshold not provided.");
+
+    char err;
+    size_t threshold = parse_size_t(argv[0], &err);
+
+    if (err)
+        die("JIT threshold must be a number.");
+
+    settings.jit_threshold = threshold;
     return 0;
 }
 
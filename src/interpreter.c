@@ -0,0 +1,261 @@
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "compiler.h"
+#include "defines.h"
+#include "interpreter.h"
+#include "jit.h"
+#include "optimizer.h"
+#include "program.h"
+#include "settings.h"
+#include "stats.h"
+
+/* Size of the input and output buffers. */
+#define IO_BUFFER_SIZE 65536
+
+static unsigned char in_buf[IO_BUFFER_SIZE];
+static size_t in_pos = 0;
+static size_t in_len = 0;
+static unsigned char out_buf[IO_BUFFER_SIZE];
+static size_t out_len = 0;
+
+/*
+ * Writes the whole output buffer, errors drop it like in compiled programs.
+ */
+static void flush_output()
+{
+    for (size_t written = 0; written < out_len;) {
+        ssize_t count = write(1, out_buf + written, out_len - written);
+        if (count <= 0)
+            break;
+        written += count;
+    }
+    out_len = 0;
+}
+
+/*
+ * Reads a character, flushing the output before waiting for more input.
+ *
+ * @return          The character or -1 at the end of input.
+ */
+static int read_input()
+{
+    if (in_pos == in_len) {
+        flush_output();
+        ssize_t count = read(0, in_buf, IO_BUFFER_SIZE);
+        in_len = count > 0 ? count : 0;
+        in_pos = 0;
+        if (!in_len)
+            return -1;
+    }
+    return in_buf[in_pos++];
+}
+
+void run_output(unsigned char *cell)
+{
+    out_buf[out_len++] = *cell;
+    if (out_len == IO_BUFFER_SIZE)
+        flush_output();
+}
+
+void run_input(unsigned char *cell)
+{
+    int c = read_input();
+    if (c >= 0)
+        *cell = c;
+}
+
+void run_map_loop(unsigned char *cell, int64_t value, int type)
+{
+    while (*cell) {
+        if (type == INS_MAP_INPUT_OUTPUT)
+            run_input(cell);
+        *cell += value;
+        run_output(cell);
+        if (type == INS_MAP_OUTPUT_INPUT)
+            run_input(cell);
+    }
+}
+
+/*
+ * Returns value of a cell of settings.cell_size bytes.
+ */
+static inline uint64_t load_cell(const unsigned char *cell)
+{
+    uint8_t u8;
+    uint16_t u16;
+    uint32_t u32;
+    uint64_t u64;
+
+    switch (settings.cell_size) {
+    case 1:
+        memcpy(&u8, cell, 1);
+        return u8;
+    case 2:
+        memcpy(&u16, cell, 2);
+        return u16;
+    case 4:
+        memcpy(&u32, cell, 4);
+        return u32;
+    default:
+        memcpy(&u64, cell, 8);
+        return u64;
+    }
+}
+
+/*
+ * Stores value to a cell of settings.cell_size bytes, dropping bits that don't fit.
+ */
+static inline void store_cell(unsigned char *cell, uint64_t value)
+{
+    uint8_t u8 = value;
+    uint16_t u16 = value;
+    uint32_t u32 = value;
+
+    switch (settings.cell_size) {
+    case 1:
+        memcpy(cell, &u8, 1);
+        break;
+    case 2:
+        memcpy(cell, &u16, 2);
+        break;
+    case 4:
+        memcpy(cell, &u32, 4);
+        break;
+    default:
+        memcpy(cell, &value, 8);
+        break;
+    }
+}
+
+/*
+ * Interprets the program, compiling hot loops.
+ *
+ * jumps holds the index of the matching bracket for loop instructions
+ * and the move in bytes, between 0 and the size of the stack, for moves.
+ * counts holds the number of back edges taken by every loop and
+ * loops its compiled code, both indexed by the loop start.
+ *
+ * In case of allocation error writes ENOMEM to errno.
+ */
+static void interpret(Program *program, unsigned char *tape, size_t *jumps,
+    size_t *counts, JitLoop **loops)
+{
+    size_t stack_bytes = settings.stack_size * settings.cell_size;
+    size_t position = 0;
+
+    for (size_t i = 0; i < program->length; ++i) {
+        Instruction *instruction = &program->data[i];
+        unsigned char *cell = tape + position;
+
+        switch (instruction->type) {
+        case INS_MOVE:
+            position += jumps[i];
+            if (position >= stack_bytes)
+                position -= stack_bytes;
+            break;
+        case INS_ADD:
+            store_cell(cell, load_cell(cell) + (uint64_t)instruction->value);
+            break;
+        case INS_SET:
+            store_cell(cell, (uint64_t)instruction->value);
+            break;
+        case INS_OUTPUT:
+            run_output(cell);
+            break;
+        case INS_INPUT:
+            run_input(cell);
+            break;
+        case INS_MAP_OUTPUT_INPUT:
+        case INS_MAP_INPUT_OUTPUT:
+            run_map_loop(cell, instruction->value, instruction->type);
+            break;
+        case INS_LOOP_START:
+            if (loops[i]) {
+                /* Compiled code runs the whole loop. */
+                position = loops[i]->run(tape, position);
+                i = jumps[i];
+            } else if (!load_cell(cell)) {
+                i = jumps[i];
+            }
+            break;
+        case INS_LOOP_END:
+            if (!load_cell(cell))
+                break;
+
+            size_t start = jumps[i];
+            if (settings.jit_threshold && ++counts[start] == settings.jit_threshold) {
+                /* Continue in compiled code from the loop header. */
+                loops[start] = jit_compile(program, start, i);
+                if (errno)
+                    return;
+                ++stats.optimizations[OPT_JIT];
+                position = loops[start]->run(tape, position);
+                break;
+            }
+            i = start;
+            break;
+        }
+    }
+}
+
+int execute(char *code)
+{
+    errno = 0;
+
+    /* Parse and optimize brainfuck code. */
+    Program *program = parse_program(code);
+    if (!program)
+        return 1;
+
+    program = optimize(program);
+    if (!program)
+        return 1;
+
+    stats.instructions = program->length;
+
+    size_t stack_bytes = settings.stack_size * settings.cell_size;
+    size_t *jumps = calloc(program->length + 1, sizeof(size_t));
+    size_t *counts = calloc(program->length + 1, sizeof(size_t));
+    JitLoop **loops = calloc(program->length + 1, sizeof(JitLoop *));
+    void *tape = mmap(NULL, stack_bytes, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+    if (jumps && counts && loops && tape != MAP_FAILED) {
+        /* Resolve brackets and normalize moves, counts is used as the stack of brackets. */
+        size_t *stack = counts;
+        size_t depth = 0;
+        for (size_t i = 0; i < program->length; ++i) {
+            Instruction *instruction = &program->data[i];
+            if (instruction->type == INS_LOOP_START) {
+                stack[depth++] = i;
+            } else if (instruction->type == INS_LOOP_END) {
+                jumps[i] = stack[--depth];
+                jumps[jumps[i]] = i;
+            } else if (instruction->type == INS_MOVE) {
+                int64_t cells = instruction->value % (int64_t)settings.stack_size;
+                jumps[i] = (cells < 0 ? cells + settings.stack_size : cells) * settings.cell_size;
+            }
+        }
+        memset(counts, 0, program->length * sizeof(size_t));
+
+        interpret(program, tape, jumps, counts, loops);
+        flush_output();
+    } else {
+        errno = ENOMEM;
+    }
+
+    if (tape != MAP_FAILED)
+        munmap(tape, stack_bytes);
+    if (loops)
+        for (size_t i = 0; i < program->length; ++i)
+            free_jit_loop(loops[i]);
+    free(loops);
+    free(counts);
+    free(jumps);
+    free_program(program);
+
+    return errno ? 1 : 0;
+}
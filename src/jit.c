@@ -0,0 +1,340 @@
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "defines.h"
+#include "interpreter.h"
+#include "jit.h"
+#include "settings.h"
+
+/*
+ * Machine code being generated.
+ */
+typedef struct {
+    size_t size;
+    size_t length;
+    unsigned char *data;
+} CodeBuffer;
+
+/*
+ * Registers of compiled loops:
+ * r15 stack, r13 offset of the current cell, r14 size of the stack in bytes.
+ * The cell is addressed as [r15 + r13], encoded by SIB byte 0x2f
+ * with REX.X and REX.B set.
+ */
+#define CELL_SIB 0x2f
+#define REX_CELL 0x43
+#define REX_CELL_W 0x4b
+
+/*
+ * Appends bytes to the code.
+ *
+ * In case of allocation error writes ENOMEM to errno.
+ */
+static void emit(CodeBuffer *code, const void *bytes, size_t length)
+{
+    if (errno)
+        return;
+
+    if (code->length + length > code->size) {
+        while (code->length + length > code->size)
+            code->size *= 2;
+        unsigned char *tmp = realloc(code->data, code->size);
+        MEMERRV(tmp)
+        code->data = tmp;
+    }
+
+    memcpy(code->data + code->length, bytes, length);
+    code->length += length;
+}
+
+static void emit_byte(CodeBuffer *code, unsigned char byte)
+{
+    emit(code, &byte, 1);
+}
+
+/*
+ * Appends a little endian value of size bytes.
+ */
+static void emit_value(CodeBuffer *code, uint64_t value, size_t size)
+{
+    unsigned char bytes[8];
+    for (size_t i = 0; i < size; ++i)
+        bytes[i] = value >> (8 * i);
+    emit(code, bytes, size);
+}
+
+/*
+ * Appends `mov rax, value`.
+ */
+static void emit_mov_rax(CodeBuffer *code, uint64_t value)
+{
+    emit(code, "\x48\xb8", 2);
+    emit_value(code, value, 8);
+}
+
+/*
+ * Appends an instruction with an immediate operand and the current cell
+ * as a memory operand of settings.cell_size bytes.
+ *
+ * @param   byte_op Opcode for 1 byte cells.
+ * @param   wide_op Opcode for longer cells.
+ * @param   reg     Value of the reg field of the ModRM byte.
+ * @param   value   Immediate operand, 32 bits sign extended for 8 byte cells.
+ * @param   size    Size of the immediate operand for cells longer than 1 byte, at most 4.
+ */
+static void emit_cell_immediate(CodeBuffer *code, unsigned char byte_op, unsigned char wide_op,
+    int reg, uint64_t value, size_t size)
+{
+    if (settings.cell_size == 2)
+        emit_byte(code, 0x66);
+    emit_byte(code, settings.cell_size == 8 ? REX_CELL_W : REX_CELL);
+    emit_byte(code, settings.cell_size == 1 ? byte_op : wide_op);
+    emit_byte(code, reg << 3 | 4);
+    emit_byte(code, CELL_SIB);
+    emit_value(code, value, settings.cell_size == 1 ? 1 : size);
+}
+
+/*
+ * Appends `cmp cell, 0`.
+ */
+static void emit_test(CodeBuffer *code)
+{
+    /* 0x83 takes a sign extended 8 bit immediate. */
+    emit_cell_immediate(code, 0x80, 0x83, 7, 0, 1);
+}
+
+/*
+ * Appends an addition or move of value to the cell,
+ * going through rax when it doesn't fit in 32 bits.
+ *
+ * @param   byte_op Opcode with an immediate operand for 1 byte cells.
+ * @param   rax_op  Opcode with rax as a source operand.
+ */
+static void emit_cell_constant(CodeBuffer *code, unsigned char byte_op, unsigned char rax_op,
+    uint64_t value)
+{
+    if (settings.cell_size == 8 && (int64_t)value != (int32_t)value) {
+        emit_mov_rax(code, value);
+        emit_byte(code, REX_CELL_W);
+        emit_byte(code, rax_op);
+        emit_byte(code, 0x04);
+        emit_byte(code, CELL_SIB);
+        return;
+    }
+    emit_cell_immediate(code, byte_op, byte_op + 1, 0, value, settings.cell_size == 2 ? 2 : 4);
+}
+
+/*
+ * Appends a call of a function with the current cell as the first argument.
+ */
+static void emit_call(CodeBuffer *code, uint64_t function)
+{
+    /* lea rdi, [r15 + r13] */
+    emit(code, "\x4b\x8d\x3c\x2f", 4);
+    emit_mov_rax(code, function);
+    /* call rax */
+    emit(code, "\xff\xd0", 2);
+}
+
+/*
+ * Appends a conditional jump with a 32 bit displacement.
+ *
+ * @param   condition   Second byte of the opcode, 0x84 for je, 0x85 for jne.
+ * @param   target      Offset of the target, ignored if it's patched later.
+ * @return              Offset of the displacement.
+ */
+static size_t emit_jump(CodeBuffer *code, unsigned char condition, size_t target)
+{
+    emit_byte(code, 0x0f);
+    emit_byte(code, condition);
+    size_t displacement = code->length;
+    emit_value(code, (uint64_t)(target - (displacement + 4)), 4);
+    return displacement;
+}
+
+/*
+ * Adds the loop to the perf map of this process,
+ * so that profilers can name the code.
+ */
+static void write_perf_map(JitLoop *loop, size_t length, Instruction *instruction)
+{
+    char path[64];
+    sprintf(path, "/tmp/perf-%ld.map", (long)getpid());
+
+    FILE *map = fopen(path, "a");
+    if (!map)
+        return;
+    fprintf(map, "%lx %zx bf_L%zu_C%zu_loop%" PRId64 "\n",
+        (unsigned long)loop->run, length,
+        instruction->line, instruction->column, instruction->value);
+    fclose(map);
+}
+
+JitLoop *jit_compile(Program *program, size_t start, size_t end)
+{
+    errno = 0;
+
+    CodeBuffer code;
+    code.size = 256;
+    code.length = 0;
+    code.data = malloc(code.size);
+    MEMERRN(code.data)
+
+    size_t *starts = malloc((end - start + 1) * sizeof(size_t));
+    MEMERRNF(starts, code.data)
+    size_t depth = 0;
+
+    uint64_t stack_bytes = settings.stack_size * settings.cell_size;
+    uint64_t mask = settings.cell_size >= 8 ? UINT64_MAX : ((uint64_t)1 << (settings.cell_size * 8)) - 1;
+
+    /*
+     * push rbx, r12, r13, r14, r15 also aligns the stack for calls.
+     * mov r15, rdi
+     * mov r13, rsi
+     * mov r14, stack_bytes
+     */
+    emit(&code, "\x53\x41\x54\x41\x55\x41\x56\x41\x57", 9);
+    emit(&code, "\x49\x89\xff\x49\x89\xf5\x49\xbe", 8);
+    emit_value(&code, stack_bytes, 8);
+
+    /*
+     * The zero flag reflects the current cell.
+     * cleared means that the current cell was just set to 0.
+     */
+    char flags_valid = 0;
+    char cleared = 0;
+
+    for (size_t i = start; i <= end; ++i) {
+        Instruction *instruction = &program->data[i];
+        uint64_t value;
+        char was_cleared = cleared;
+        cleared = 0;
+
+        switch (instruction->type) {
+        case INS_MOVE:
+            value = (uint64_t)((instruction->value % (int64_t)settings.stack_size)
+                        + (int64_t)settings.stack_size)
+                % settings.stack_size * settings.cell_size;
+
+            /* add r13, value */
+            if (value <= INT32_MAX) {
+                emit(&code, "\x49\x81\xc5", 3);
+                emit_value(&code, value, 4);
+            } else {
+                emit_mov_rax(&code, value);
+                emit(&code, "\x49\x01\xc5", 3);
+            }
+            /* cmp r13, r14; jb +3; sub r13, r14 */
+            emit(&code, "\x4d\x39\xf5\x72\x03\x4d\x29\xf5", 8);
+            flags_valid = 0;
+            break;
+        case INS_ADD:
+            /* Addition sets the zero flag according to the result. */
+            emit_cell_constant(&code, 0x80, 0x01, (uint64_t)instruction->value & mask);
+            flags_valid = 1;
+            break;
+        case INS_SET:
+            emit_cell_constant(&code, 0xc6, 0x89, (uint64_t)instruction->value & mask);
+            flags_valid = 0;
+            cleared = !((uint64_t)instruction->value & mask);
+            break;
+        case INS_OUTPUT:
+            emit_call(&code, (uint64_t)run_output);
+            flags_valid = 0;
+            break;
+        case INS_INPUT:
+            emit_call(&code, (uint64_t)run_input);
+            flags_valid = 0;
+            break;
+        case INS_MAP_OUTPUT_INPUT:
+        case INS_MAP_INPUT_OUTPUT:
+            /* mov rsi, value; mov edx, type */
+            emit(&code, "\x48\xbe", 2);
+            emit_value(&code, (uint64_t)instruction->value, 8);
+            emit_byte(&code, 0xba);
+            emit_value(&code, instruction->type, 4);
+            emit_call(&code, (uint64_t)run_map_loop);
+            flags_valid = 0;
+            break;
+        case INS_LOOP_START:
+            /* Jump past the loop is patched at its end. */
+            if (!flags_valid)
+                emit_test(&code);
+            starts[depth++] = emit_jump(&code, 0x84, 0);
+            flags_valid = 1;
+            break;
+        case INS_LOOP_END:
+            /* Loops ending with `[-]` run at most once and don't need the back edge. */
+            if (!flags_valid && !was_cleared)
+                emit_test(&code);
+            size_t displacement = starts[--depth];
+            if (!was_cleared)
+                emit_jump(&code, 0x85, displacement + 4);
+            if (!errno) {
+                uint64_t offset = code.length - (displacement + 4);
+                for (int j = 0; j < 4; ++j)
+                    code.data[displacement + j] = offset >> (8 * j);
+            }
+            flags_valid = !was_cleared;
+            break;
+        }
+    }
+
+    /*
+     * mov rax, r13
+     * pop r15, r14, r13, r12, rbx
+     * ret
+     */
+    emit(&code, "\x4c\x89\xe8\x41\x5f\x41\x5e\x41\x5d\x41\x5c\x5b\xc3", 13);
+
+    free(starts);
+
+    JitLoop *loop = malloc(sizeof(JitLoop));
+    if (errno || !loop) {
+        free(loop);
+        free(code.data);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    /* Copy the code to executable memory, which isn't writable at the same time. */
+    long page = sysconf(_SC_PAGESIZE);
+    loop->size = (code.length + page - 1) / page * page;
+    void *memory = mmap(NULL, loop->size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (memory == MAP_FAILED) {
+        free(loop);
+        free(code.data);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    memcpy(memory, code.data, code.length);
+    size_t length = code.length;
+    free(code.data);
+
+    if (mprotect(memory, loop->size, PROT_READ | PROT_EXEC)) {
+        munmap(memory, loop->size);
+        free(loop);
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    loop->run = (JitFunction)memory;
+
+    if (settings.debug)
+        write_perf_map(loop, length, &program->data[start]);
+
+    return loop;
+}
+
+void free_jit_loop(JitLoop *loop)
+{
+    if (!loop)
+        return;
+    munmap((void *)loop->run, loop->size);
+    free(loop);
+}
@@ -0,0 +1,331 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <immintrin.h>
+#endif
+
+#include "defines.h"
+#include "lexer.h"
+
+/* Number of bytes classified at once. */
+#define BLOCK_SIZE 32
+
+/*
+ * Bit masks of a block of code, bit i describes byte i.
+ * Masks are wider than the block, so a run filling it still ends at a clear bit.
+ */
+typedef struct {
+    uint64_t commands;
+    uint64_t plus;
+    uint64_t minus;
+    uint64_t left;
+    uint64_t right;
+    uint64_t newlines;
+} Block;
+
+/*
+ * Function classifying BLOCK_SIZE bytes of code.
+ */
+typedef void (*Classifier)(const char *data, Block *block);
+
+#ifdef __SSE2__
+/*
+ * Tables of the nibble lookup with pshufb. Each low nibble maps to the set
+ * of high nibbles it's a command with: `+,-.` have high nibble 2, `<>` have 3 and `[]` have 5.
+ */
+#define LOW_NIBBLES 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1 | 4, 1 | 2, 1 | 4, 1 | 2, 0
+#define HIGH_NIBBLES 0, 0, 1, 2, 0, 4, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+
+#define EQUAL(bytes, c) ((uint64_t)(uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8(bytes, _mm_set1_epi8(c))))
+
+/*
+ * Adds masks of all but commands of 16 bytes starting at offset in the block.
+ */
+static inline void compare_sse2(__m128i bytes, int offset, Block *block)
+{
+    block->plus |= EQUAL(bytes, '+') << offset;
+    block->minus |= EQUAL(bytes, '-') << offset;
+    block->left |= EQUAL(bytes, '<') << offset;
+    block->right |= EQUAL(bytes, '>') << offset;
+    block->newlines |= EQUAL(bytes, '\n') << offset;
+}
+
+/*
+ * Classifies BLOCK_SIZE bytes of code with SSE2, 16 at a time.
+ */
+static void classify_sse2(const char *data, Block *block)
+{
+    memset(block, 0, sizeof(Block));
+    for (int offset = 0; offset < BLOCK_SIZE; offset += 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i *)(data + offset));
+        compare_sse2(bytes, offset, block);
+        block->commands |= (EQUAL(bytes, '.') | EQUAL(bytes, ',') | EQUAL(bytes, '[') | EQUAL(bytes, ']'))
+            << offset;
+    }
+    block->commands |= block->plus | block->minus | block->left | block->right;
+}
+
+/*
+ * Classifies BLOCK_SIZE bytes of code with SSSE3, 16 at a time,
+ * looking commands up by both nibbles with pshufb.
+ */
+__attribute__((target("ssse3")))
+static void classify_ssse3(const char *data, Block *block)
+{
+    const __m128i low_table = _mm_setr_epi8(LOW_NIBBLES);
+    const __m128i high_table = _mm_setr_epi8(HIGH_NIBBLES);
+    const __m128i nibble = _mm_set1_epi8(0x0f);
+
+    memset(block, 0, sizeof(Block));
+    for (int offset = 0; offset < BLOCK_SIZE; offset += 16) {
+        __m128i bytes = _mm_loadu_si128((const __m128i *)(data + offset));
+        compare_sse2(bytes, offset, block);
+
+        __m128i low = _mm_shuffle_epi8(low_table, _mm_and_si128(bytes, nibble));
+        __m128i high = _mm_shuffle_epi8(high_table, _mm_and_si128(_mm_srli_epi16(bytes, 4), nibble));
+        __m128i matched = _mm_and_si128(low, high);
+        block->commands |= (~EQUAL(matched, 0) & 0xffff) << offset;
+    }
+}
+
+#undef EQUAL
+#define EQUAL(bytes, c) \
+    ((uint64_t)(uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, _mm256_set1_epi8(c))))
+
+/*
+ * Classifies BLOCK_SIZE bytes of code at once with AVX2, with the same lookup
+ * as classify_ssse3 in both 16 byte lanes.
+ */
+__attribute__((target("avx2")))
+static void classify_avx2(const char *data, Block *block)
+{
+    const __m256i low_table = _mm256_setr_epi8(LOW_NIBBLES, LOW_NIBBLES);
+    const __m256i high_table = _mm256_setr_epi8(HIGH_NIBBLES, HIGH_NIBBLES);
+    const __m256i nibble = _mm256_set1_epi8(0x0f);
+
+    __m256i bytes = _mm256_loadu_si256((const __m256i *)data);
+    block->plus = EQUAL(bytes, '+');
+    block->minus = EQUAL(bytes, '-');
+    block->left = EQUAL(bytes, '<');
+    block->right = EQUAL(bytes, '>');
+    block->newlines = EQUAL(bytes, '\n');
+
+    __m256i low = _mm256_shuffle_epi8(low_table, _mm256_and_si256(bytes, nibble));
+    __m256i high = _mm256_shuffle_epi8(high_table, _mm256_and_si256(_mm256_srli_epi16(bytes, 4), nibble));
+    __m256i matched = _mm256_and_si256(low, high);
+    block->commands = ~EQUAL(matched, 0) & 0xffffffff;
+}
+
+#undef EQUAL
+#else
+/*
+ * Classifies BLOCK_SIZE bytes of code one by one.
+ */
+static void classify_bytes(const char *data, Block *block)
+{
+    memset(block, 0, sizeof(Block));
+    for (int i = 0; i < BLOCK_SIZE; ++i) {
+        uint64_t bit = (uint64_t)1 << i;
+        switch (data[i]) {
+        case '+':
+            block->plus |= bit;
+            break;
+        case '-':
+            block->minus |= bit;
+            break;
+        case '<':
+            block->left |= bit;
+            break;
+        case '>':
+            block->right |= bit;
+            break;
+        case '\n':
+            block->newlines |= bit;
+            continue;
+        case '.':
+        case ',':
+        case '[':
+        case ']':
+            break;
+        default:
+            continue;
+        }
+        block->commands |= bit;
+    }
+}
+#endif
+
+/*
+ * Returns the widest classifier the processor supports, chosen on the first call.
+ */
+static Classifier classifier()
+{
+    static Classifier chosen = NULL;
+    if (chosen)
+        return chosen;
+
+#ifdef __SSE2__
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+        chosen = classify_avx2;
+    else if (__builtin_cpu_supports("ssse3"))
+        chosen = classify_ssse3;
+    else
+        chosen = classify_sse2;
+#else
+    chosen = classify_bytes;
+#endif
+    return chosen;
+}
+
+/*
+ * Appends an instruction, adding it to the last one if both are
+ * additions or moves, as folding doesn't depend on comments between them.
+ * Value is a run of the same commands, so an instruction is removed when
+ * they add up to 0 and the rest of the run starts a new one.
+ *
+ * In case of allocation error writes ENOMEM to errno.
+ */
+static void add_token(Tokens *tokens, size_t *size, char type, int64_t value,
+    size_t line, size_t column)
+{
+    if (tokens->length && (type == INS_ADD || type == INS_MOVE)
+        && tokens->data[tokens->length - 1].type == type) {
+        Instruction *last = &tokens->data[tokens->length - 1];
+        uint64_t magnitude = last->value < 0 ? -(uint64_t)last->value : (uint64_t)last->value;
+        uint64_t count = value < 0 ? -(uint64_t)value : (uint64_t)value;
+
+        if ((last->value < 0) == (value < 0) || count <= magnitude) {
+            last->value = (int64_t)((uint64_t)last->value + (uint64_t)value);
+            if (!last->value)
+                --tokens->length;
+            return;
+        }
+
+        --tokens->length;
+        column += magnitude;
+        value = (int64_t)((uint64_t)value + (uint64_t)last->value);
+    }
+
+    if (tokens->length == *size) {
+        *size *= 2;
+        Instruction *tmp = realloc(tokens->data, *size * sizeof(Instruction));
+        MEMERRV(tmp)
+        tokens->data = tmp;
+    }
+
+    Instruction *token = &tokens->data[tokens->length++];
+    token->type = type;
+    token->value = value;
+    token->line = line;
+    token->column = column;
+}
+
+Tokens *lex(const char *code, size_t length)
+{
+    errno = 0;
+
+    Tokens *tokens = malloc(sizeof(Tokens));
+    MEMERRN(tokens)
+
+    size_t size = 256;
+    tokens->length = 0;
+    tokens->ops = 0;
+    tokens->data = malloc(size * sizeof(Instruction));
+    MEMERRNF(tokens->data, tokens)
+
+    size_t line = 1;
+    size_t line_start = 0; /* Index of the first character of the line. */
+
+    Classifier classify = classifier();
+    for (size_t base = 0; base < length; base += BLOCK_SIZE) {
+        Block block;
+        if (length - base >= BLOCK_SIZE) {
+            classify(code + base, &block);
+        } else {
+            char tail[BLOCK_SIZE] = { 0 };
+            memcpy(tail, code + base, length - base);
+            classify(tail, &block);
+        }
+
+        /* Handle runs of commands, blocks of comments are skipped at once. */
+        uint64_t commands = block.commands;
+        while (commands) {
+            int i = __builtin_ctzll(commands);
+
+            /* Position of the command from newlines before it in the block. */
+            uint64_t newlines = block.newlines & (((uint64_t)1 << i) - 1);
+            size_t command_line = line + __builtin_popcountll(newlines);
+            size_t command_start = newlines ? base + 64 - __builtin_clzll(newlines) : line_start;
+
+            /*
+             * Runs of the same command are folded with their masks.
+             * Other commands, including `+` next to `-`, are added one by one,
+             * so that instructions adding up to 0 are removed where it happens.
+             */
+            int run = 1;
+            char type;
+            int64_t value = 0;
+
+            switch (code[base + i]) {
+            case '+':
+                run = __builtin_ctzll(~(block.plus >> i));
+                type = INS_ADD;
+                value = run;
+                break;
+            case '-':
+                run = __builtin_ctzll(~(block.minus >> i));
+                type = INS_ADD;
+                value = -(int64_t)run;
+                break;
+            case '>':
+                run = __builtin_ctzll(~(block.right >> i));
+                type = INS_MOVE;
+                value = run;
+                break;
+            case '<':
+                run = __builtin_ctzll(~(block.left >> i));
+                type = INS_MOVE;
+                value = -(int64_t)run;
+                break;
+            case '.':
+                type = INS_OUTPUT;
+                break;
+            case ',':
+                type = INS_INPUT;
+                break;
+            case '[':
+                type = INS_LOOP_START;
+                break;
+            default:
+                type = INS_LOOP_END;
+                break;
+            }
+
+            commands &= ~((((uint64_t)1 << run) - 1) << i);
+            tokens->ops += run;
+
+            add_token(tokens, &size, type, value, command_line, base + i - command_start + 1);
+            if (errno) {
+                free_tokens(tokens);
+                return NULL;
+            }
+        }
+
+        line += __builtin_popcountll(block.newlines);
+        if (block.newlines)
+            line_start = base + 64 - __builtin_clzll(block.newlines);
+    }
+
+    return tokens;
+}
+
+void free_tokens(Tokens *tokens)
+{
+    if (!tokens)
+        return;
+    free(tokens->data);
+    free(tokens);
+}
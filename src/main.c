@@ -1,59 +1,29 @@
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
 
 #include "compiler.h"
 #include "functions.h"
+#include "interpreter.h"
 #include "options.h"
+#include "server.h"
 #include "settings.h"
+#include "stats.h"
 
-int main(int argc, char **argv)
-{
-    settings.program_name = argv[0];
-
-    /* Check if nasm and ld are installed */
-    int nasm_status = system("nasm --version > /dev/null 2>&1");
-    int ld_status = system("ld --version > /dev/null 2>&1");
-
-    if (nasm_status)
-        die("`nasm` not found.");
-
-    if (ld_status)
-        die("`ld` not found.");
-
-    if (argc < 2)
-        help(0, NULL);
-
-    /*
-     * Initialize `Options` struct
-     * and declare command line arguments.
-     */
-    Options *options = init_options();
-    if (errno)
-        die("Memory allocaiton failed.");
-
-    /* Prints help */
-    add_option(options, "help", 'h', 0, 0, help);
-
-    /* Sets input and output files */
-    add_option(options, "input", 'i', 1, 1, input_file);
-    add_option(options, "output", 'o', 1, 1, output_file);
-    add_option(options, NULL, 0, 1, 1, file);
-
-    /* Sets stack and cell size */
-    add_option(options, "stack_size", 's', 1, 1, stack_size);
-    add_option(options, "cell_size", 'c', 1, 1, cell_size);
-
-    /* Tells if output should be assembly. */
-    add_option(options, "output_assembly", 'S', 0, 0, assembly);
-
-    /*
-     * Parse command line arguments
-     */
+/* Options declared once, so that the compile server can reuse them. */
+static Options *options;
 
-    char **args = argv + 1;
-    size_t arg_count = argc - 1;
+/* Settings before parsing arguments, restored for every request of the server. */
+static Settings defaults;
 
+/*
+ * Calls functions of options provided in arguments.
+ */
+static void parse_arguments(size_t arg_count, char **args)
+{
     for (ArgInfo *arg = parse_argument(options, &arg_count, &args);
          arg;
          arg = parse_argument(options, &arg_count, &args)) {
@@ -69,20 +39,100 @@ int main(int argc, char **argv)
 
         free(arg);
     }
+}
 
-    free_options(options);
+/* Assemblers and ld already found by this process or the server that forked it. */
+static char assembler_found[ASSEMBLER_GAS + 1];
+static char ld_found;
+
+/*
+ * Checks if the selected assembler and, if link is set, ld are installed.
+ */
+static void check_tools(char link)
+{
+    if (!assembler_found[settings.assembler]) {
+        int assembler_status = settings.assembler == ASSEMBLER_GAS
+            ? system("as --version > /dev/null 2>&1")
+            : system("nasm --version > /dev/null 2>&1");
+
+        if (assembler_status)
+            die(settings.assembler == ASSEMBLER_GAS ? "`as` not found." : "`nasm` not found.");
+        assembler_found[settings.assembler] = 1;
+    }
+
+    if (link && !ld_found) {
+        if (system("ld --version > /dev/null 2>&1"))
+            die("`ld` not found.");
+        ld_found = 1;
+    }
+}
+
+/*
+ * Runs a tool found in PATH with the arguments and waits for it.
+ * No shell is involved, so paths from the command line or a request
+ * of the compile server are never interpreted.
+ *
+ * @param   argv    Name of the tool followed by its arguments, terminated by NULL.
+ * @return          0 if the tool exited with status 0, 1 otherwise.
+ */
+static int run_tool(char *const argv[])
+{
+    fflush(NULL);
+    pid_t pid = fork();
+    if (pid < 0)
+        return 1;
+    if (pid == 0) {
+        execvp(argv[0], argv);
+        _exit(127);
+    }
+
+    int status;
+    while (waitpid(pid, &status, 0) < 0)
+        if (errno != EINTR)
+            return 1;
+    return !WIFEXITED(status) || WEXITSTATUS(status);
+}
 
+/*
+ * Removes temporary files of the build and exits with the message.
+ */
+static void die_building(const char *msg, const char *temp_name, const char *temp_name_o)
+{
+    remove(temp_name);
+    if (temp_name_o)
+        remove(temp_name_o);
+    die(msg);
+}
+
+/*
+ * Compiles the input file according to the settings.
+ *
+ * @return          Exit status.
+ */
+static int build()
+{
     /*
      * Check if input and output files were provided.
      */
     if (!settings.input_file)
         die("Input file not provided.");
-    if (!settings.output_file)
+    if (!settings.output_file && !settings.run)
         die("Output file not provided.");
 
+    /* Only executables enforce budgets, a build that would run without them is refused. */
+    if ((settings.max_steps || settings.max_output || settings.max_time)
+        && (settings.run || settings.emit == EMIT_OBJECT))
+        die("Budgets can't be used with --run or --emit=object.");
+
+    /* Check tools of the output before compiling, a request of the server may select another assembler. */
+    if (!settings.run && settings.emit != EMIT_ASSEMBLY)
+        check_tools(settings.emit == EMIT_EXECUTABLE);
+
     /*
      * Read input file.
      */
+    stats_start(PHASE_READ);
+
     FILE *input_file = fopen(settings.input_file, "r");
     if (input_file == NULL) {
         die("Failed to open input file.");
@@ -105,11 +155,24 @@ int main(int argc, char **argv)
 
     fclose(input_file);
 
+    stats.input_bytes = file_size;
+    stats_stop(PHASE_READ);
+
     /*
-     * Compile brainfuck code and check for errors.
+     * Compile or run brainfuck code and check for errors.
      */
 
-    char *compiled = compile(buffer);
+    char *compiled = NULL;
+    int status = 0;
+    if (settings.run) {
+        stats_start(PHASE_RUN);
+        status = execute(buffer);
+        stats_stop(PHASE_RUN);
+    } else {
+        stats_start(PHASE_COMPILE);
+        compiled = compile(buffer);
+        stats_stop(PHASE_COMPILE);
+    }
 
     int error = errno;
 
@@ -128,10 +191,14 @@ int main(int argc, char **argv)
     free(buffer);
 
     /*
-     * Depending on the settings, output either assembly or an executable.
+     * Depending on the settings, output assembly, an object or an executable.
      */
 
-    if (settings.assembly) {
+    if (settings.run) {
+        /* The program already ran. */
+    } else if (settings.emit == EMIT_ASSEMBLY) {
+        stats_start(PHASE_WRITE);
+
         /* Open output file */
         FILE *output_file = fopen(settings.output_file, "w");
         if (output_file == NULL)
@@ -143,7 +210,11 @@ int main(int argc, char **argv)
         free(compiled);
 
         fclose(output_file);
+
+        stats_stop(PHASE_WRITE);
     } else {
+        stats_start(PHASE_WRITE);
+
         /* Create temporary file. */
         char temp_name[] = "/tmp/bfcomp_XXXXXX";
         int temp_descriptor = mkstemp(temp_name);
@@ -163,28 +234,175 @@ int main(int argc, char **argv)
 
         fclose(temp_file);
 
-        /* Assemble and link executable. */
-        char nasm[] = "nasm -f elf64 -w-all %s";
-        char ld[] = "ld %s.o -o %s";
+        stats_stop(PHASE_WRITE);
+
+        /* Assemble the object, and link executable unless the object is the output. */
+        char object = settings.emit == EMIT_OBJECT;
+        const char *object_name = object ? settings.output_file : temp_name_o;
 
-        char nasm_command[sizeof(nasm) + L_tmpnam];
-        sprintf(nasm_command, nasm, temp_name);
-        system(nasm_command);
+        /* GNU as gets line information from .loc directives in the code. */
+        char *nasm[] = { "nasm", "-f", "elf64", "-w-all", temp_name, "-o", (char *)object_name,
+            NULL, NULL, NULL, NULL };
+        char *gas[] = { "as", temp_name, "-o", (char *)object_name, NULL };
+        char *ld[] = { "ld", temp_name_o, "-o", settings.output_file, NULL };
 
-        char ld_command[sizeof(ld) + L_tmpnam + strlen(settings.output_file)];
-        sprintf(ld_command, ld, temp_name, settings.output_file);
-        system(ld_command);
+        if (settings.debug) {
+            nasm[7] = "-g";
+            nasm[8] = "-F";
+            nasm[9] = "dwarf";
+        }
+
+        stats_start(PHASE_ASSEMBLE);
+        if (run_tool(settings.assembler == ASSEMBLER_GAS ? gas : nasm))
+            die_building(settings.assembler == ASSEMBLER_GAS ? "`as` failed." : "`nasm` failed.",
+                temp_name, object ? NULL : temp_name_o);
+        stats_stop(PHASE_ASSEMBLE);
+
+        if (!object) {
+            stats_start(PHASE_LINK);
+            if (run_tool(ld))
+                die_building("`ld` failed.", temp_name, temp_name_o);
+            stats_stop(PHASE_LINK);
+        }
+
+        if (settings.stats)
+            stats.text_bytes = text_size(settings.output_file);
 
         /* Remove temporary files. */
         char error = 0;
         if (remove(temp_name))
             error = 1;
-        if (remove(temp_name_o))
+        if (!object && remove(temp_name_o))
             error = 1;
 
         if (error)
             die("Failed to remove temporary files");
     }
 
-    return 0;
+    if (settings.stats)
+        print_stats(stderr);
+
+    return status;
+}
+
+/*
+ * Handles arguments sent to the compile server as if they were provided on the command line.
+ */
+static int handle_request(size_t argc, char **argv)
+{
+    settings = defaults;
+
+    if (argc < 1)
+        help(0, NULL);
+
+    parse_arguments(argc, argv);
+
+    if (settings.serve)
+        die("Server can't be started by a request.");
+
+    return build();
+}
+
+int main(int argc, char **argv)
+{
+    settings.program_name = argv[0];
+
+    /* Let the compile server handle the arguments if one is set. */
+    char *server = getenv(SERVER_VARIABLE);
+    if (server && argc > 1) {
+        char serving = 0;
+        for (int i = 1; i < argc; ++i)
+            serving |= strcmp(argv[i], "--serve") == 0 || strncmp(argv[i], "--serve=", 8) == 0;
+
+        int status = serving ? -1 : request_server(server, argc - 1, argv + 1);
+        if (status >= 0)
+            return status;
+    }
+
+    if (argc < 2)
+        help(0, NULL);
+
+    /*
+     * Initialize `Options` struct
+     * and declare command line arguments.
+     */
+    options = init_options();
+    if (errno)
+        die("Memory allocaiton failed.");
+
+    /* Prints help */
+    add_option(options, "help", 'h', 0, 0, help);
+
+    /* Sets input and output files */
+    add_option(options, "input", 'i', 1, 1, input_file);
+    add_option(options, "output", 'o', 1, 1, output_file);
+    add_option(options, NULL, 0, 1, 1, file);
+
+    /* Sets stack and cell size */
+    add_option(options, "stack_size", 's', 1, 1, stack_size);
+    add_option(options, "cell_size", 'c', 1, 1, cell_size);
+
+    /* Sets type of the output, assembly, object or executable. */
+    add_option(options, "output_assembly", 'S', 0, 0, assembly);
+    add_option(options, "emit", 0, 1, 1, emit);
+
+    /* Sets assembler of objects and executables. */
+    add_option(options, "assembler", 0, 1, 1, assembler);
+
+    /* Sets instruction sets of runtime kernels. */
+    add_option(options, "march", 0, 1, 1, march);
+
+    /* Prints build statistics. */
+    add_option(options, "stats", 0, 0, 1, statistics);
+
+    /* Sets how the stack is allocated. */
+    add_option(options, "tape", 0, 1, 1, tape);
+
+    /* Optimizes for speed or size. */
+    add_option(options, "optimize", 'O', 1, 1, optimization_goal);
+
+    /* Memoizes loops without input or output. */
+    add_option(options, "memoize", 0, 0, 0, memoize);
+
+    /* Reports the state of executables on SIGUSR1. */
+    add_option(options, "introspect", 0, 0, 1, introspect);
+
+    /* Stops executables that exceed their budgets. */
+    add_option(options, "max_steps", 0, 1, 1, max_steps);
+    add_option(options, "max_output", 0, 1, 1, max_output);
+    add_option(options, "max_time", 0, 1, 1, max_time);
+
+    /* Forks executables for every run requested by a runner. */
+    add_option(options, "fork_server", 0, 0, 0, fork_server);
+
+    /* Runs a compile server. */
+    add_option(options, "serve", 0, 1, 1, serve_socket);
+    add_option(options, "workers", 0, 1, 1, workers);
+
+    /* Runs the program in this process. */
+    add_option(options, "run", 'r', 0, 0, run);
+    add_option(options, "jit_threshold", 0, 1, 1, jit_threshold);
+
+    /* Adds debugging information. */
+    add_option(options, "debug", 'g', 0, 0, debug);
+
+    /*
+     * Parse command line arguments
+     */
+    defaults = settings;
+    parse_arguments(argc - 1, argv + 1);
+
+    /* Handle requests in processes forked from warm workers. */
+    if (settings.serve) {
+        /* Workers inherit the tools found here. */
+        if (!settings.run && settings.emit != EMIT_ASSEMBLY)
+            check_tools(settings.emit == EMIT_EXECUTABLE);
+        serve(settings.serve, settings.workers, handle_request);
+        free_options(options);
+        return 0;
+    }
+
+    free_options(options);
+
+    return build();
 }
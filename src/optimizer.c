@@ -0,0 +1,709 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "defines.h"
+#include "optimizer.h"
+#include "settings.h"
+#include "stats.h"
+
+/* Maximum number of instructions executed when evaluating a single loop. */
+#define EVALUATION_LIMIT 100000
+/* Maximum number of instructions executed when evaluating all loops. */
+#define EVALUATION_BUDGET 10000000
+/* Maximum number of instructions a loop may grow to when unrolled. */
+#define UNROLL_LIMIT 256
+/* Maximum unroll factor of loops that are not unrolled completely. */
+#define UNROLL_FACTOR 8
+/* Maximum number of tracked cells, everything is forgotten when exceeded. */
+#define KNOWLEDGE_LIMIT 4096
+
+/*
+ * Value of a cell at compile time.
+ */
+typedef struct {
+    int64_t offset;
+    char known;
+    uint64_t value;
+} Cell;
+
+/*
+ * Values of cells known at compile time.
+ *
+ * Offsets are relative to the position the stack pointer had
+ * when the knowledge was last reset, wrapped to the stack size.
+ */
+typedef struct {
+    char zero; /* Cells that aren't listed are known to be 0. */
+    int64_t position;
+    size_t length;
+    size_t size;
+    Cell *cells;
+} Knowledge;
+
+/*
+ * Information about the body of a loop.
+ */
+typedef struct {
+    char simple; /* Contains only moves and additions. */
+    char fixed; /* All loops are balanced, so every instruction has a fixed offset. */
+    char io; /* Contains input or output. */
+    char counter_fixed; /* Counter is changed only by additions outside nested loops. */
+    uint64_t step; /* Total change of the counter in one iteration. */
+} LoopInfo;
+
+/*
+ * State shared by the whole optimization.
+ */
+typedef struct {
+    size_t budget; /* Remaining number of instructions that can be evaluated. */
+    size_t limit; /* Maximum length of the output, stops unrolling when reached. */
+} Optimizer;
+
+static void optimize_into(Optimizer *optimizer, Program *in, Program *out, Knowledge *knowledge);
+
+/*
+ * Returns mask of the bits that fit in a cell.
+ */
+static uint64_t cell_mask()
+{
+    return settings.cell_size >= 8 ? UINT64_MAX : ((uint64_t)1 << (settings.cell_size * 8)) - 1;
+}
+
+/*
+ * Wraps offset to the range [0, stack_size).
+ */
+static int64_t wrap(int64_t offset)
+{
+    int64_t size = (int64_t)settings.stack_size;
+    return ((offset % size) + size) % size;
+}
+
+/*
+ * Returns the shortest move from one offset to another.
+ */
+static int64_t distance(int64_t from, int64_t to)
+{
+    int64_t size = (int64_t)settings.stack_size;
+    int64_t d = wrap(to - from);
+    return d > size / 2 ? d - size : d;
+}
+
+/*
+ * Forgets all known values.
+ * Offsets stay relative to the current position of the stack pointer.
+ */
+static void forget(Knowledge *knowledge)
+{
+    knowledge->zero = 0;
+    knowledge->length = 0;
+    knowledge->position = 0;
+}
+
+/*
+ * Gets value of a cell.
+ *
+ * @return  1 if the value is known, 0 otherwise.
+ */
+static char get_cell(Knowledge *knowledge, int64_t offset, uint64_t *value)
+{
+    for (size_t i = 0; i < knowledge->length; ++i) {
+        if (knowledge->cells[i].offset == offset) {
+            *value = knowledge->cells[i].value;
+            return knowledge->cells[i].known;
+        }
+    }
+
+    *value = 0;
+    return knowledge->zero;
+}
+
+/*
+ * Sets value of a cell, or marks it as unknown if known is 0.
+ *
+ * In case of allocation error writes ENOMEM to errno.
+ */
+static void set_cell(Knowledge *knowledge, int64_t offset, char known, uint64_t value)
+{
+    for (size_t i = 0; i < knowledge->length; ++i) {
+        if (knowledge->cells[i].offset == offset) {
+            knowledge->cells[i].known = known;
+            knowledge->cells[i].value = value & cell_mask();
+            return;
+        }
+    }
+
+    if (!known && !knowledge->zero)
+        return;
+
+    if (knowledge->length == KNOWLEDGE_LIMIT) {
+        int64_t position = knowledge->position;
+        forget(knowledge);
+        knowledge->position = position;
+        if (!known)
+            return;
+    }
+
+    if (knowledge->length == knowledge->size) {
+        knowledge->size = knowledge->size ? knowledge->size * 2 : 64;
+        Cell *tmp = realloc(knowledge->cells, knowledge->size * sizeof(Cell));
+        MEMERRV(tmp)
+        knowledge->cells = tmp;
+    }
+
+    knowledge->cells[knowledge->length].offset = offset;
+    knowledge->cells[knowledge->length].known = known;
+    knowledge->cells[knowledge->length].value = value & cell_mask();
+    ++knowledge->length;
+}
+
+/*
+ * Copies knowledge from src to dst.
+ *
+ * In case of allocation error writes ENOMEM to errno.
+ */
+static void copy_knowledge(Knowledge *dst, Knowledge *src)
+{
+    if (dst->size < src->length) {
+        Cell *tmp = realloc(dst->cells, src->length * sizeof(Cell));
+        MEMERRV(tmp)
+        dst->cells = tmp;
+        dst->size = src->length;
+    }
+
+    if (src->length)
+        memcpy(dst->cells, src->cells, src->length * sizeof(Cell));
+    dst->length = src->length;
+    dst->zero = src->zero;
+    dst->position = src->position;
+}
+
+static int compare_cells(const void *a, const void *b)
+{
+    int64_t x = ((const Cell *)a)->offset;
+    int64_t y = ((const Cell *)b)->offset;
+    return (x > y) - (x < y);
+}
+
+/*
+ * Returns multiplicative inverse of an odd number modulo 2^64.
+ */
+static uint64_t inverse(uint64_t value)
+{
+    uint64_t x = value;
+    for (int i = 0; i < 5; ++i)
+        x *= 2 - value * x;
+    return x;
+}
+
+/*
+ * Returns number of iterations after which a counter with value
+ * reaches 0 when changed by an odd step every iteration.
+ */
+static uint64_t trip_count(uint64_t value, uint64_t step)
+{
+    return (-value * inverse(step)) & cell_mask();
+}
+
+/*
+ * Collects information about the loop between start and end.
+ */
+static void analyze_loop(Program *program, size_t start, size_t end, LoopInfo *info)
+{
+    info->simple = 1;
+    info->fixed = 1;
+    info->io = 0;
+    info->counter_fixed = 1;
+    info->step = 0;
+
+    int64_t position = 0;
+    int64_t *positions = malloc((end - start) * sizeof(int64_t));
+    MEMERRV(positions)
+    size_t depth = 0;
+
+    for (size_t i = start + 1; i < end; ++i) {
+        Instruction *ins = &program->data[i];
+        char counter = info->fixed && wrap(position) == 0;
+
+        switch (ins->type) {
+        case INS_MOVE:
+            position += ins->value;
+            break;
+        case INS_ADD:
+            if (counter && !depth)
+                info->step += ins->value;
+            else if (counter)
+                info->counter_fixed = 0;
+            break;
+        case INS_SET:
+            info->simple = 0;
+            if (counter)
+                info->counter_fixed = 0;
+            break;
+        case INS_OUTPUT:
+            info->simple = 0;
+            info->io = 1;
+            break;
+        case INS_INPUT:
+        case INS_MAP_OUTPUT_INPUT:
+        case INS_MAP_INPUT_OUTPUT:
+            info->simple = 0;
+            info->io = 1;
+            if (counter)
+                info->counter_fixed = 0;
+            break;
+        case INS_LOOP_START:
+            info->simple = 0;
+            positions[depth++] = position;
+            break;
+        case INS_LOOP_END:
+            if (wrap(position - positions[--depth]))
+                info->fixed = 0;
+            break;
+        }
+    }
+
+    if (wrap(position))
+        info->fixed = 0;
+    if (!info->fixed)
+        info->counter_fixed = 0;
+
+    free(positions);
+}
+
+/*
+ * Moves the stack pointer to offset and records it in knowledge.
+ */
+static void move_to(Program *out, Knowledge *knowledge, int64_t offset)
+{
+    push_instruction(out, INS_MOVE, distance(knowledge->position, offset));
+    knowledge->position = offset;
+}
+
+/*
+ * Tries to run the loop at compile time.
+ * Succeeds if the loop reads only known cells and finishes within the limits.
+ * On success writes instructions setting the changed cells to out.
+ *
+ * @return  1 on success, 0 otherwise.
+ */
+static char evaluate_loop(Optimizer *optimizer, Program *in, size_t *match,
+    size_t start, size_t end, Program *out, Knowledge *knowledge)
+{
+    Knowledge state = { 0 };
+    copy_knowledge(&state, knowledge);
+    if (errno)
+        return 0;
+
+    size_t steps = 0;
+    char success = 1;
+    uint64_t value;
+
+    for (size_t i = start; i <= end && success; ++i) {
+        Instruction *ins = &in->data[i];
+
+        if (++steps > EVALUATION_LIMIT || steps > optimizer->budget) {
+            success = 0;
+            break;
+        }
+
+        switch (ins->type) {
+        case INS_MOVE:
+            state.position = wrap(state.position + ins->value);
+            break;
+        case INS_ADD:
+            if (!get_cell(&state, state.position, &value))
+                success = 0;
+            else
+                set_cell(&state, state.position, 1, value + ins->value);
+            break;
+        case INS_SET:
+            set_cell(&state, state.position, 1, ins->value);
+            break;
+        case INS_LOOP_START:
+            if (!get_cell(&state, state.position, &value))
+                success = 0;
+            else if (!value)
+                i = match[i];
+            break;
+        case INS_LOOP_END:
+            if (!get_cell(&state, state.position, &value))
+                success = 0;
+            else if (value)
+                i = match[i];
+            break;
+        default:
+            success = 0;
+        }
+
+        /* Cells would be forgotten, so the changes couldn't be collected. */
+        if (errno || state.length == KNOWLEDGE_LIMIT)
+            success = 0;
+    }
+
+    optimizer->budget -= steps < optimizer->budget ? steps : optimizer->budget;
+
+    if (success) {
+        /* Collect changed cells and write them in order of their offsets. */
+        Cell *changed = malloc((state.length + 1) * sizeof(Cell));
+        if (!changed) {
+            errno = ENOMEM;
+            free(state.cells);
+            return 0;
+        }
+
+        size_t count = 0;
+        for (size_t i = 0; i < state.length; ++i) {
+            uint64_t before;
+            char known = get_cell(knowledge, state.cells[i].offset, &before);
+            if (state.cells[i].known && (!known || before != state.cells[i].value))
+                changed[count++] = state.cells[i];
+        }
+
+        qsort(changed, count, sizeof(Cell), compare_cells);
+
+        for (size_t i = 0; i < count; ++i) {
+            move_to(out, knowledge, changed[i].offset);
+            push_instruction(out, INS_SET, changed[i].value);
+        }
+        move_to(out, knowledge, state.position);
+
+        free(changed);
+        copy_knowledge(knowledge, &state);
+    }
+
+    free(state.cells);
+    return success;
+}
+
+/*
+ * Replaces a loop containing only moves and additions, whose counter
+ * reaches 0 after known number of iterations, with the total changes.
+ */
+static void closed_form_loop(Program *in, size_t start, size_t end, uint64_t iterations,
+    Program *out, Knowledge *knowledge)
+{
+    Knowledge deltas = { 0 };
+    int64_t position = 0;
+
+    for (size_t i = start + 1; i < end && !errno; ++i) {
+        Instruction *ins = &in->data[i];
+        uint64_t delta;
+
+        if (ins->type == INS_MOVE) {
+            position = wrap(position + ins->value);
+        } else if (ins->type == INS_ADD && position) {
+            get_cell(&deltas, position, &delta);
+            set_cell(&deltas, position, 1, delta + ins->value);
+        }
+    }
+
+    if (!errno)
+        qsort(deltas.cells, deltas.length, sizeof(Cell), compare_cells);
+
+    int64_t counter = knowledge->position;
+    for (size_t i = 0; i < deltas.length && !errno; ++i) {
+        uint64_t total = deltas.cells[i].value * iterations;
+        uint64_t value;
+
+        if (!(total & cell_mask()))
+            continue;
+
+        int64_t offset = wrap(counter + deltas.cells[i].offset);
+        move_to(out, knowledge, offset);
+
+        if (get_cell(knowledge, offset, &value)) {
+            push_instruction(out, INS_SET, (value + total) & cell_mask());
+            set_cell(knowledge, offset, 1, value + total);
+        } else {
+            push_instruction(out, INS_ADD, total);
+        }
+    }
+
+    move_to(out, knowledge, counter);
+    push_instruction(out, INS_SET, 0);
+    set_cell(knowledge, counter, 1, 0);
+
+    free(deltas.cells);
+}
+
+/*
+ * Replaces loops that only pass their input to the output,
+ * optionally adding a constant to every character, like `[.,]` or `[,.]`,
+ * with instructions that process the input in blocks.
+ *
+ * Loops run until the cell is 0, which can be checked only one character
+ * at a time, so they are supported only with 1 byte cells.
+ *
+ * @return  1 if the loop was replaced, 0 otherwise.
+ */
+static char io_loop(Program *in, size_t start, size_t end, Program *out)
+{
+    /* Objects don't have the global buffers used by bf_map_loop, budgets count every character. */
+    if (settings.cell_size != 1 || settings.emit == EMIT_OBJECT || settings.introspect
+        || settings.max_steps || settings.max_output || settings.max_time || end - start < 3 || end - start > 4)
+        return 0;
+
+    Instruction *body = &in->data[start + 1];
+    size_t length = end - start - 1;
+    int64_t value = 0;
+
+    /* [+.,] */
+    if (body[length - 2].type == INS_OUTPUT && body[length - 1].type == INS_INPUT
+        && (length == 2 || body[0].type == INS_ADD)) {
+        if (length == 3)
+            value = body[0].value;
+        push_instruction(out, INS_MAP_OUTPUT_INPUT, value);
+        return !errno;
+    }
+
+    /* [,+.] */
+    if (body[0].type == INS_INPUT && body[length - 1].type == INS_OUTPUT
+        && (length == 2 || body[1].type == INS_ADD)) {
+        if (length == 3)
+            value = body[1].value;
+        push_instruction(out, INS_MAP_INPUT_OUTPUT, value);
+        return !errno;
+    }
+
+    return 0;
+}
+
+/*
+ * Writes the body of the loop repeated count times to a new program.
+ *
+ * @return  New program, NULL in case of allocation error.
+ */
+static Program *repeat_body(Program *in, size_t start, size_t end, uint64_t count)
+{
+    Program *body = init_program();
+    MEMERRN(body)
+
+    for (uint64_t n = 0; n < count; ++n) {
+        for (size_t i = start + 1; i < end; ++i) {
+            body->line = in->data[i].line;
+            body->column = in->data[i].column;
+            push_instruction(body, in->data[i].type, in->data[i].value);
+            if (errno) {
+                free_program(body);
+                return NULL;
+            }
+        }
+    }
+
+    return body;
+}
+
+/*
+ * Writes a loop that cannot be removed, optimizing its body without knowledge.
+ * The loop ends at position of instruction end.
+ */
+static void keep_loop(Optimizer *optimizer, Program *body, Instruction *end,
+    Program *out, Knowledge *knowledge)
+{
+    push_instruction(out, INS_LOOP_START, 0);
+    forget(knowledge);
+    optimize_into(optimizer, body, out, knowledge);
+    out->line = end->line;
+    out->column = end->column;
+    push_instruction(out, INS_LOOP_END, 0);
+
+    /* The loop ends only when the current cell is 0. */
+    forget(knowledge);
+    set_cell(knowledge, 0, 1, 0);
+}
+
+/*
+ * Optimizes the loop between start and end.
+ */
+static void optimize_loop(Optimizer *optimizer, Program *in, size_t *match,
+    size_t start, size_t end, Program *out, Knowledge *knowledge)
+{
+    uint64_t counter;
+    char known = get_cell(knowledge, knowledge->position, &counter);
+
+    /* Loop that is never entered. */
+    if (known && !counter) {
+        ++stats.optimizations[OPT_DEAD_LOOP];
+        return;
+    }
+
+    if (io_loop(in, start, end, out)) {
+        set_cell(knowledge, knowledge->position, 1, 0);
+        ++stats.optimizations[OPT_IO_LOOP];
+        return;
+    }
+
+    LoopInfo info;
+    analyze_loop(in, start, end, &info);
+    if (errno)
+        return;
+
+    char counted = info.counter_fixed && (info.step & 1);
+
+    if (known && !info.io) {
+        if (evaluate_loop(optimizer, in, match, start, end, out, knowledge)) {
+            ++stats.optimizations[OPT_EVALUATE];
+            return;
+        }
+        if (errno)
+            return;
+    }
+
+    if (known && counted && info.simple) {
+        closed_form_loop(in, start, end, trip_count(counter, info.step), out, knowledge);
+        ++stats.optimizations[OPT_CLOSED_FORM];
+        return;
+    }
+
+    /* Loop that only changes its counter by an odd step ends with it set to 0. */
+    if (counted && info.simple && end - start == 2) {
+        push_instruction(out, INS_SET, 0);
+        set_cell(knowledge, knowledge->position, 1, 0);
+        ++stats.optimizations[OPT_CLEAR];
+        return;
+    }
+
+    Program *body = NULL;
+
+    /* Unrolling makes the code larger. */
+    if (known && counted && !settings.optimize_size && out->length < optimizer->limit) {
+        uint64_t iterations = trip_count(counter, info.step);
+        size_t length = end - start - 1;
+
+        if (iterations <= UNROLL_LIMIT && iterations * length <= UNROLL_LIMIT) {
+            /* Unroll completely, the body no longer runs in a loop. */
+            body = repeat_body(in, start, end, iterations);
+            if (!body)
+                return;
+            optimize_into(optimizer, body, out, knowledge);
+            free_program(body);
+            ++stats.optimizations[OPT_UNROLL];
+            return;
+        }
+
+        uint64_t factor = UNROLL_FACTOR;
+        while (factor > 1 && (iterations % factor || factor * length > UNROLL_LIMIT))
+            --factor;
+
+        if (factor > 1) {
+            body = repeat_body(in, start, end, factor);
+            if (!body)
+                return;
+            ++stats.optimizations[OPT_UNROLL];
+        }
+    }
+
+    if (!body) {
+        body = repeat_body(in, start, end, 1);
+        if (!body)
+            return;
+    }
+
+    keep_loop(optimizer, body, &in->data[end], out, knowledge);
+    free_program(body);
+}
+
+/*
+ * Optimizes instructions of in and appends them to out.
+ */
+static void optimize_into(Optimizer *optimizer, Program *in, Program *out, Knowledge *knowledge)
+{
+    /* Find matching brackets. */
+    size_t *match = malloc((in->length + 1) * sizeof(size_t));
+    MEMERRV(match)
+
+    size_t *stack = malloc((in->length + 1) * sizeof(size_t));
+    MEMERRVF(stack, match)
+
+    size_t depth = 0;
+    for (size_t i = 0; i < in->length; ++i) {
+        if (in->data[i].type == INS_LOOP_START) {
+            stack[depth++] = i;
+        } else if (in->data[i].type == INS_LOOP_END) {
+            match[i] = stack[--depth];
+            match[match[i]] = i;
+        }
+    }
+    free(stack);
+
+    uint64_t value;
+
+    for (size_t i = 0; i < in->length && !errno; ++i) {
+        Instruction *ins = &in->data[i];
+
+        out->line = ins->line;
+        out->column = ins->column;
+
+        switch (ins->type) {
+        case INS_MOVE:
+            push_instruction(out, INS_MOVE, ins->value);
+            knowledge->position = wrap(knowledge->position + ins->value);
+            break;
+        case INS_ADD:
+            if (get_cell(knowledge, knowledge->position, &value)) {
+                push_instruction(out, INS_SET, (value + ins->value) & cell_mask());
+                set_cell(knowledge, knowledge->position, 1, value + ins->value);
+            } else {
+                push_instruction(out, INS_ADD, ins->value);
+            }
+            break;
+        case INS_SET:
+            push_instruction(out, INS_SET, ins->value);
+            set_cell(knowledge, knowledge->position, 1, ins->value);
+            break;
+        case INS_INPUT:
+            push_instruction(out, INS_INPUT, 0);
+            set_cell(knowledge, knowledge->position, 0, 0);
+            break;
+        case INS_MAP_OUTPUT_INPUT:
+        case INS_MAP_INPUT_OUTPUT:
+            push_instruction(out, ins->type, ins->value);
+            set_cell(knowledge, knowledge->position, 1, 0);
+            break;
+        case INS_LOOP_START:
+            optimize_loop(optimizer, in, match, i, match[i], out, knowledge);
+            i = match[i];
+            break;
+        default:
+            push_instruction(out, ins->type, ins->value);
+        }
+    }
+
+    free(match);
+}
+
+Program *optimize(Program *program)
+{
+    errno = 0;
+
+    Program *out = init_program();
+    MEMERRN(out)
+
+    Optimizer optimizer = {
+        .budget = EVALUATION_BUDGET,
+        .limit = program->length * 2 + 65536
+    };
+
+    /* All cells are 0 when the program starts. */
+    Knowledge knowledge = {
+        .zero = 1,
+        .position = 0,
+        .length = 0,
+        .size = 0,
+        .cells = NULL
+    };
+
+    optimize_into(&optimizer, program, out, &knowledge);
+    free(knowledge.cells);
+    free_program(program);
+
+    if (!errno)
+        label_loops(out);
+
+    if (errno) {
+        free_program(out);
+        return NULL;
+    }
+
+    return out;
+}
@@ -84,16 +84,21 @@ Option *get_option(Options *options, int type, char *key)
 {
     switch (type) {
     /* If type == OPTION_LONG searches long keys. */
-    case OPTION_LONG:
+    case OPTION_LONG: {
+        size_t length = strcspn(key, "=");
         for (int i = 0; i < options->count; i++)
-            if (strcmp(options->list[i].key, key) == 0)
+            if (options->list[i].key
+                && strncmp(options->list[i].key, key, length) == 0
+                && options->list[i].key[length] == '\0')
                 return &options->list[i];
         return NULL;
+    }
 
-    /* If type == OPTION_SHORT searches long keys. */
+    /* If type == OPTION_SHORT searches short keys. */
     case OPTION_SHORT:
         for (int i = 0; i < options->count; i++)
-            if (options->list[i].key_short == *key && *(key + 1) == '\0')
+            if (options->list[i].key_short && options->list[i].key_short == *key
+                && (*(key + 1) == '\0' || options->list[i].arg_max))
                 return &options->list[i];
         return NULL;
 
@@ -112,6 +117,7 @@ ArgInfo *parse_argument(Options *options, size_t *argc, char ***argv)
 
     ArgInfo *info = malloc(sizeof(ArgInfo));
     MEMERRN(info);
+    info->value = NULL;
 
     /* If argument doesn't start with '-' assume OPTION_WORD */
     if ((*argv)[0][0] != '-') {
@@ -136,9 +142,34 @@ ArgInfo *parse_argument(Options *options, size_t *argc, char ***argv)
          * Else also point to the next argument but return pointer to the invalid argument
          * in opt_argv and number of arguments to the next option in opt_argc.
          */
-        if (info->option) {
+        char *value = NULL;
+        if ((*argv)[0][1] == '-')
+            value = strchr((*argv)[0], '=');
+        else if ((*argv)[0][1] != '\0' && (*argv)[0][2] != '\0')
+            value = (*argv)[0] + 1;
+
+        /* Options without arguments can't be given a value. */
+        if (info->option && value && !info->option->arg_max) {
+            info->option = NULL;
+            info->opt_argc = 1;
+            info->opt_argv = *argv;
+            ++*argv;
+            --*argc;
+        } else if (info->option && value) {
+            /* Value provided with `--key=value` or `-kvalue` is the only argument. */
+            info->value = value + 1;
+            info->opt_argc = 1;
+            info->opt_argv = &info->value;
+            ++*argv;
+            --*argc;
+        } else if (info->option) {
+            /*
+             * Optional arguments of options that take no required ones
+             * are only given with `--key=value`, so the next word stays a word.
+             */
+            size_t arg_max = info->option->arg_min ? info->option->arg_max : 0;
             for (info->opt_argc = 1;
-                 info->opt_argc < *argc && info->opt_argc < info->option->arg_max + 1
+                 info->opt_argc < *argc && info->opt_argc < arg_max + 1
                  && (*argv)[info->opt_argc][0] != '-';
                  ++info->opt_argc)
                 ;
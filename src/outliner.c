@@ -0,0 +1,331 @@
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "defines.h"
+#include "outliner.h"
+#include "stats.h"
+
+/* Longest and shortest windows of instructions searched for repeats. */
+#define OUTLINE_MAX_WINDOW 1024
+#define OUTLINE_MIN_WINDOW 2
+
+/* Base of the polynomial hash of windows. */
+#define OUTLINE_BASE 0x100000001b3
+
+/*
+ * Estimated sizes of machine code in bytes.
+ * Both a call site and the end of a subroutine
+ * point r14 to the cell and load it to the register.
+ */
+#define OUTLINE_CALL_SIZE 13
+#define OUTLINE_RETURN_SIZE 9
+
+/*
+ * Smallest subroutine that is outlined,
+ * so that `call` and `ret` take little time compared to its body.
+ */
+#define OUTLINE_MIN_SIZE 48
+
+/*
+ * Smallest number of bytes a subroutine has to save,
+ * so that it frees at least a cache line.
+ */
+#define OUTLINE_MIN_SAVING 64
+
+/*
+ * Entry of the hash table of windows.
+ *
+ * first and last are the first and the last occurrence of the window,
+ * occurrences in between are linked with the next array.
+ */
+typedef struct {
+    uint64_t hash;
+    size_t first;
+    size_t last;
+    size_t count;
+} Window;
+
+/*
+ * Returns hash of an instruction, labels of loops are ignored.
+ */
+static uint64_t instruction_hash(Instruction *instruction)
+{
+    uint64_t value = instruction->type == INS_LOOP_START || instruction->type == INS_LOOP_END
+        ? 0
+        : (uint64_t)instruction->value;
+    return (value ^ ((uint64_t)instruction->type << 56)) * 0x9e3779b97f4a7c15 + instruction->type;
+}
+
+/*
+ * Checks if two instructions compile to the same code, labels of loops are ignored.
+ */
+static char same_instruction(Instruction *a, Instruction *b)
+{
+    if (a->type != b->type)
+        return 0;
+    return a->type == INS_LOOP_START || a->type == INS_LOOP_END || a->value == b->value;
+}
+
+/*
+ * Checks if sequences of length instructions starting at a and b are the same.
+ */
+static char same_sequence(Program *program, size_t a, size_t b, size_t length)
+{
+    for (size_t i = 0; i < length; ++i)
+        if (!same_instruction(&program->data[a + i], &program->data[b + i]))
+            return 0;
+    return 1;
+}
+
+/*
+ * Returns estimated size of the machine code of an instruction in bytes.
+ */
+static size_t instruction_size(Instruction *instruction)
+{
+    char large = instruction->value > INT32_MAX || instruction->value < -INT32_MAX;
+
+    switch (instruction->type) {
+    case INS_MOVE:
+        return 32;
+    case INS_ADD:
+        return large ? 14 : 4;
+    case INS_SET:
+        return large ? 10 : 6;
+    case INS_OUTPUT:
+        return 28;
+    case INS_INPUT:
+        return 16;
+    case INS_MAP_OUTPUT_INPUT:
+    case INS_MAP_INPUT_OUTPUT:
+        return 24;
+    default:
+        return 12;
+    }
+}
+
+/*
+ * Adds a subroutine with the sequence at occurrences[0]
+ * and replaces all occurrences with calls to it.
+ *
+ * In case of allocation error writes ENOMEM to errno.
+ */
+static void add_subroutine(Outline *outline, char *used,
+    size_t *occurrences, size_t count, size_t length)
+{
+    if (outline->count == outline->size) {
+        outline->size *= 2;
+        Subroutine *tmp = realloc(outline->data, outline->size * sizeof(Subroutine));
+        MEMERRV(tmp)
+        outline->data = tmp;
+    }
+
+    outline->data[outline->count].start = occurrences[0];
+    outline->data[outline->count].length = length;
+    ++outline->count;
+
+    for (size_t k = 0; k < count; ++k) {
+        outline->calls[occurrences[k]] = outline->count;
+        memset(used + occurrences[k], 1, length);
+    }
+    stats.optimizations[OPT_OUTLINE] += count;
+}
+
+/*
+ * Outlines sequences of window instructions that repeat in the program
+ * and don't overlap already outlined ones.
+ *
+ * In case of allocation error writes ENOMEM to errno.
+ */
+static void outline_windows(Program *program, Outline *outline, size_t window,
+    uint64_t *hashes, size_t *depth, char *used, size_t *covered, size_t *next,
+    size_t *queue, Window *table, size_t table_size, size_t *groups, size_t *occurrences)
+{
+    size_t length = program->length;
+    Instruction *data = program->data;
+
+    uint64_t power = 1;
+    for (size_t i = 0; i < window; ++i)
+        power *= OUTLINE_BASE;
+
+    covered[0] = 0;
+    for (size_t i = 0; i < length; ++i)
+        covered[i + 1] = covered[i] + used[i];
+
+    memset(table, 0, table_size * sizeof(Window));
+
+    /*
+     * Group equal windows that don't overlap outlined sequences or each other.
+     * A window has matched brackets when the depth is the same at its ends
+     * and never lower in between, its minimum is kept in a monotonic queue.
+     */
+    size_t group_count = 0;
+    size_t head = 0;
+    size_t tail = 0;
+
+    for (size_t end = 0; end <= length; ++end) {
+        while (tail > head && depth[queue[tail - 1]] >= depth[end])
+            --tail;
+        queue[tail++] = end;
+
+        if (end < window)
+            continue;
+
+        size_t start = end - window;
+        while (queue[head] < start)
+            ++head;
+
+        if (covered[end] != covered[start] || depth[end] != depth[start]
+            || depth[queue[head]] < depth[start])
+            continue;
+
+        uint64_t hash = hashes[end] - hashes[start] * power;
+        size_t slot = hash & (table_size - 1);
+        while (table[slot].count && table[slot].hash != hash)
+            slot = (slot + 1) & (table_size - 1);
+
+        Window *entry = &table[slot];
+        if (!entry->count) {
+            entry->hash = hash;
+            entry->first = start;
+            entry->last = start;
+            entry->count = 1;
+            continue;
+        }
+
+        if (start < entry->last + window || !same_sequence(program, entry->first, start, window))
+            continue;
+
+        next[entry->last] = start;
+        entry->last = start;
+        if (++entry->count == 2)
+            groups[group_count++] = slot;
+    }
+
+    for (size_t g = 0; g < group_count; ++g) {
+        Window *entry = &table[groups[g]];
+
+        /* Skip occurrences outlined by previous groups. */
+        size_t count = 0;
+        for (size_t k = 0, i = entry->first; k < entry->count; ++k, i = next[i])
+            if (!memchr(used + i, 1, window))
+                occurrences[count++] = i;
+
+        if (count < 2)
+            continue;
+
+        /* Extend the sequence while all occurrences are equal. */
+        size_t extended = window;
+        for (;; ++extended) {
+            size_t k = 0;
+            for (; k < count; ++k) {
+                size_t i = occurrences[k] + extended;
+                if (i >= length || used[i] || (k + 1 < count && i >= occurrences[k + 1])
+                    || !same_instruction(&data[occurrences[0] + extended], &data[i]))
+                    break;
+            }
+            if (k < count)
+                break;
+        }
+
+        /* Shorten it to the longest sequence with matched brackets. */
+        size_t sequence = window;
+        size_t nested = 0;
+        for (size_t i = window; i < extended; ++i) {
+            char type = data[occurrences[0] + i].type;
+            if (type == INS_LOOP_START)
+                ++nested;
+            else if (type == INS_LOOP_END && !nested--)
+                break;
+            if (!nested)
+                sequence = i + 1;
+        }
+
+        /* Outline only if it's large enough and saves enough space. */
+        size_t size = 0;
+        for (size_t i = 0; i < sequence; ++i)
+            size += instruction_size(&data[occurrences[0] + i]);
+
+        if (size < OUTLINE_MIN_SIZE
+            || count * (size - OUTLINE_CALL_SIZE) < size + OUTLINE_RETURN_SIZE + OUTLINE_MIN_SAVING)
+            continue;
+
+        add_subroutine(outline, used, occurrences, count, sequence);
+        if (errno)
+            return;
+    }
+}
+
+Outline *outline_program(Program *program)
+{
+    errno = 0;
+
+    Outline *outline = malloc(sizeof(Outline));
+    MEMERRN(outline)
+
+    size_t length = program->length;
+    size_t table_size = 16;
+    while (table_size < length * 2)
+        table_size *= 2;
+
+    outline->count = 0;
+    outline->size = 16;
+    outline->data = malloc(outline->size * sizeof(Subroutine));
+    outline->calls = calloc(length + 1, sizeof(size_t));
+
+    uint64_t *hashes = malloc((length + 1) * sizeof(uint64_t));
+    size_t *depth = malloc((length + 1) * sizeof(size_t));
+    char *used = calloc(length + 1, 1);
+    size_t *covered = malloc((length + 1) * sizeof(size_t));
+    size_t *next = malloc((length + 1) * sizeof(size_t));
+    size_t *queue = malloc((length + 1) * sizeof(size_t));
+    Window *table = malloc(table_size * sizeof(Window));
+    size_t *groups = malloc((length + 1) * sizeof(size_t));
+    size_t *occurrences = malloc((length + 1) * sizeof(size_t));
+
+    if (outline->data && outline->calls && hashes && depth && used && covered
+        && next && queue && table && groups && occurrences) {
+        /* Prefix hashes and depth of brackets before every instruction. */
+        hashes[0] = 0;
+        depth[0] = 0;
+        for (size_t i = 0; i < length; ++i) {
+            char type = program->data[i].type;
+            hashes[i + 1] = hashes[i] * OUTLINE_BASE + instruction_hash(&program->data[i]);
+            depth[i + 1] = depth[i] + (type == INS_LOOP_START) - (type == INS_LOOP_END);
+        }
+
+        /* Longer sequences save more, so they are outlined first. */
+        for (size_t window = OUTLINE_MAX_WINDOW; window >= OUTLINE_MIN_WINDOW && !errno; window /= 2)
+            if (window * 2 <= length)
+                outline_windows(program, outline, window, hashes, depth, used, covered,
+                    next, queue, table, table_size, groups, occurrences);
+    } else {
+        errno = ENOMEM;
+    }
+
+    free(hashes);
+    free(depth);
+    free(used);
+    free(covered);
+    free(next);
+    free(queue);
+    free(table);
+    free(groups);
+    free(occurrences);
+
+    if (errno) {
+        free_outline(outline);
+        return NULL;
+    }
+
+    return outline;
+}
+
+void free_outline(Outline *outline)
+{
+    if (!outline)
+        return;
+    free(outline->data);
+    free(outline->calls);
+    free(outline);
+}
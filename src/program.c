@@ -0,0 +1,178 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "compiler.h"
+#include "defines.h"
+#include "lexer.h"
+#include "program.h"
+#include "stats.h"
+
+Program *init_program()
+{
+    errno = 0;
+    Program *program = malloc(sizeof(Program));
+    MEMERRN(program)
+    program->length = 0;
+    program->size = 256;
+    program->line = 1;
+    program->column = 1;
+    program->data = malloc(program->size * sizeof(Instruction));
+    MEMERRNF(program->data, program)
+    return program;
+}
+
+void free_program(Program *program)
+{
+    if (!program)
+        return;
+    free(program->data);
+    free(program);
+}
+
+void push_instruction(Program *program, char type, int64_t value)
+{
+    Instruction *last = program->length ? &program->data[program->length - 1] : NULL;
+
+    /* Merge with the previous instruction if possible. */
+    if (last && (type == INS_MOVE || type == INS_ADD)
+        && (last->type == type || (type == INS_ADD && last->type == INS_SET))) {
+        last->value = (int64_t)((uint64_t)last->value + (uint64_t)value);
+        if (last->type != INS_SET && last->value == 0)
+            --program->length;
+        return;
+    }
+
+    /* Set overwrites the previous addition or set. */
+    if (last && type == INS_SET && (last->type == INS_ADD || last->type == INS_SET)) {
+        last->type = INS_SET;
+        last->value = value;
+        return;
+    }
+
+    if ((type == INS_MOVE || type == INS_ADD) && value == 0)
+        return;
+
+    /* Make sure there is enough space in the list. */
+    if (program->length == program->size) {
+        program->size *= 2;
+        Instruction *tmp = realloc(program->data, program->size * sizeof(Instruction));
+        MEMERRV(tmp)
+        program->data = tmp;
+    }
+
+    program->data[program->length].type = type;
+    program->data[program->length].value = value;
+    program->data[program->length].line = program->line;
+    program->data[program->length].column = program->column;
+    ++program->length;
+}
+
+size_t loop_end(Program *program, size_t start)
+{
+    size_t depth = 0;
+    for (size_t i = start; i < program->length; ++i) {
+        if (program->data[i].type == INS_LOOP_START)
+            ++depth;
+        else if (program->data[i].type == INS_LOOP_END && --depth == 0)
+            return i;
+    }
+    return program->length;
+}
+
+void label_loops(Program *program)
+{
+    size_t *stack = malloc((program->length + 1) * sizeof(size_t));
+    MEMERRV(stack)
+
+    size_t depth = 0;
+    int64_t label_index = 0;
+    for (size_t i = 0; i < program->length; ++i) {
+        if (program->data[i].type == INS_LOOP_START) {
+            program->data[i].value = label_index++;
+            stack[depth++] = i;
+        } else if (program->data[i].type == INS_LOOP_END) {
+            program->data[i].value = program->data[stack[--depth]].value;
+        }
+    }
+
+    free(stack);
+}
+
+Program *parse_program(char *code)
+{
+    if (code == NULL) {
+        errno = EINVAL;
+        return NULL;
+    }
+
+    /* Split the code into instructions. */
+    size_t length = strlen(code);
+    stats_start(PHASE_LEX);
+    Tokens *tokens = lex(code, length);
+    stats_stop(PHASE_LEX);
+    if (!tokens)
+        return NULL;
+
+    stats.lexed_bytes += length;
+
+    Program *program = init_program();
+    if (errno) {
+        free_tokens(tokens);
+        return NULL;
+    }
+
+    size_t depth = 0; /* Number of currently open brackets. */
+
+    for (size_t i = 0; i < tokens->length; ++i) {
+        Instruction *token = &tokens->data[i];
+
+        if (token->type == INS_LOOP_START) {
+            ++depth;
+            ++stats.loops;
+        } else if (token->type == INS_LOOP_END) {
+            if (!depth) {
+                free_tokens(tokens);
+                free_program(program);
+                errno = EUNCLOSED;
+                return NULL;
+            }
+            --depth;
+        }
+
+        program->line = token->line;
+        program->column = token->column;
+        push_instruction(program, token->type, token->value);
+        if (errno) {
+            free_tokens(tokens);
+            free_program(program);
+            return NULL;
+        }
+    }
+
+    size_t ops = tokens->ops; /* Number of brainfuck instructions in the code. */
+    free_tokens(tokens);
+
+    stats.bf_ops += ops;
+    stats.optimizations[OPT_FOLD] += ops - program->length;
+
+    /* Check if there was any brainfuck code and return error. */
+    if (!ops)
+        errno = ENOCODE;
+
+    /* Check if brackets are closed and return error. */
+    if (depth)
+        errno = EUNCLOSED;
+
+    if (errno) {
+        free_program(program);
+        return NULL;
+    }
+
+    label_loops(program);
+    if (errno) {
+        free_program(program);
+        return NULL;
+    }
+
+    return program;
+}
@@ -0,0 +1,1025 @@
+#include <stddef.h>
+
+#include "bfcomp.h"
+#include "runtime.h"
+
+#define STRING(x) #x
+#define NUMBER(x) STRING(x)
+
+_Static_assert(offsetof(bf_io, read) == 0 && offsetof(bf_io, write) == 8
+        && offsetof(bf_io, context) == 16,
+    "runtime_object expects this layout of bf_io");
+_Static_assert(OBJECT_FRAME_SIZE >= OBJECT_SCAN_KERNELS + 16 && OBJECT_FRAME_SIZE % 16 == 8,
+    "runtime_object frame is too small");
+
+/* The message and the newline. */
+_Static_assert(sizeof(TAPE_ERROR_MESSAGE) == 41, "runtime_tape_error writes 41 bytes");
+
+const char runtime_tape_error[] = "bf_tape_error:\n"
+                                  "mov rax, 1\n"
+                                  "mov rdi, 2\n"
+                                  "lea rsi, [bf_tape_message]\n"
+                                  "mov rdx, 41\n"
+                                  "syscall\n"
+                                  "mov rax, 0x3c\n"
+                                  "mov rdi, 1\n"
+                                  "syscall\n";
+
+const RuntimeData runtime_io_data[] = {
+    { "bf_in_buf", 65536 },
+    { "bf_in_pos", 8 },
+    { "bf_in_len", 8 },
+    { "bf_out_buf", 65536 },
+    { "bf_out_len", 8 },
+    { NULL, 0 }
+};
+
+const char runtime_io[] = /* Writes the whole output buffer, errors drop it like with `.`. */
+                          "bf_flush:\n"
+                          "mov rdx, [bf_out_len]\n"
+                          "lea rsi, [bf_out_buf]\n"
+                          "bf_flush_loop:\n"
+                          "test rdx, rdx\n"
+                          "jz bf_flush_end\n"
+                          "mov rax, 1\n"
+                          "mov rdi, 1\n"
+                          "syscall\n"
+                          "test rax, rax\n"
+                          "jle bf_flush_end\n"
+                          "add rsi, rax\n"
+                          "sub rdx, rax\n"
+                          "jmp bf_flush_loop\n"
+                          "bf_flush_end:\n"
+                          "xor ecx, ecx\n"
+                          "mov [bf_out_len], rcx\n"
+                          "ret\n"
+                          /* Fills the input buffer, returns number of read bytes in rax. */
+                          "bf_refill:\n"
+                          "call bf_flush\n"
+                          "mov rax, 0\n"
+                          "mov rdi, 0\n"
+                          "lea rsi, [bf_in_buf]\n"
+                          "mov rdx, 65536\n"
+                          "syscall\n"
+                          "test rax, rax\n"
+                          "jg bf_refill_end\n"
+                          "xor eax, eax\n"
+                          "bf_refill_end:\n"
+                          "mov [bf_in_len], rax\n"
+                          "xor ecx, ecx\n"
+                          "mov [bf_in_pos], rcx\n"
+                          "ret\n"
+                          /* Reads a character to [rsi]. */
+                          "bf_read:\n"
+                          "mov rax, [bf_in_pos]\n"
+                          "cmp rax, [bf_in_len]\n"
+                          "jb bf_read_byte\n"
+                          "push rsi\n"
+                          "call bf_refill\n"
+                          "pop rsi\n"
+                          "test rax, rax\n"
+                          "jz bf_read_end\n"
+                          "xor eax, eax\n"
+                          "bf_read_byte:\n"
+                          "mov cl, [bf_in_buf + rax]\n"
+                          "mov [rsi], cl\n"
+                          "inc rax\n"
+                          "mov [bf_in_pos], rax\n"
+                          "bf_read_end:\n"
+                          "ret\n";
+
+const char runtime_object[] = /* Writes the output buffer with the write callback. */
+                              "bf_flush:\n"
+                              "mov rdx, [rbx + " NUMBER(OBJECT_OUT_LEN) "]\n"
+                              "test rdx, rdx\n"
+                              "jz bf_flush_end\n"
+                              "mov rax, [rbx + " NUMBER(OBJECT_IO) "]\n"
+                              "mov rdi, [rax + 16]\n"
+                              "lea rsi, [rbx + " NUMBER(OBJECT_OUT_BUF) "]\n"
+                              "mov rax, [rax + 8]\n"
+                              "mov rbp, rsp\n"
+                              "and rsp, -16\n"
+                              "call rax\n"
+                              "mov rsp, rbp\n"
+                              "test rax, rax\n"
+                              "js bf_write_error\n"
+                              "xor ecx, ecx\n"
+                              "mov [rbx + " NUMBER(OBJECT_OUT_LEN) "], rcx\n"
+                              "bf_flush_end:\n"
+                              "ret\n"
+                              "bf_write_error:\n"
+                              "mov eax, " NUMBER(BF_ERROR_WRITE) "\n"
+                              "jmp bf_fail\n"
+                              /* Fills the input buffer with the read callback, returns number of read bytes in rax. */
+                              "bf_refill:\n"
+                              "call bf_flush\n"
+                              "mov rax, [rbx + " NUMBER(OBJECT_IO) "]\n"
+                              "mov rdi, [rax + 16]\n"
+                              "lea rsi, [rbx + " NUMBER(OBJECT_IN_BUF) "]\n"
+                              "mov edx, " NUMBER(OBJECT_BUFFER_SIZE) "\n"
+                              "mov rax, [rax]\n"
+                              "mov rbp, rsp\n"
+                              "and rsp, -16\n"
+                              "call rax\n"
+                              "mov rsp, rbp\n"
+                              "test rax, rax\n"
+                              "js bf_read_error\n"
+                              "mov [rbx + " NUMBER(OBJECT_IN_LEN) "], rax\n"
+                              "xor ecx, ecx\n"
+                              "mov [rbx + " NUMBER(OBJECT_IN_POS) "], rcx\n"
+                              "ret\n"
+                              "bf_read_error:\n"
+                              "mov eax, " NUMBER(BF_ERROR_READ) "\n"
+                              "jmp bf_fail\n"
+                              /* Reads a character to [rsi], it's unchanged at the end of input. */
+                              "bf_read:\n"
+                              "mov rax, [rbx + " NUMBER(OBJECT_IN_POS) "]\n"
+                              "cmp rax, [rbx + " NUMBER(OBJECT_IN_LEN) "]\n"
+                              "jb bf_read_byte\n"
+                              "push rsi\n"
+                              "call bf_refill\n"
+                              "pop rsi\n"
+                              "test rax, rax\n"
+                              "jz bf_read_end\n"
+                              "xor eax, eax\n"
+                              "bf_read_byte:\n"
+                              "mov cl, [rbx + " NUMBER(OBJECT_IN_BUF) " + rax]\n"
+                              "mov [rsi], cl\n"
+                              "inc rax\n"
+                              "mov [rbx + " NUMBER(OBJECT_IN_POS) "], rax\n"
+                              "bf_read_end:\n"
+                              "ret\n"
+                              /* Appends the character at [rsi] to the output buffer. */
+                              "bf_write:\n"
+                              "mov rax, [rbx + " NUMBER(OBJECT_OUT_LEN) "]\n"
+                              "mov cl, [rsi]\n"
+                              "mov [rbx + " NUMBER(OBJECT_OUT_BUF) " + rax], cl\n"
+                              "inc rax\n"
+                              "mov [rbx + " NUMBER(OBJECT_OUT_LEN) "], rax\n"
+                              "cmp rax, " NUMBER(OBJECT_BUFFER_SIZE) "\n"
+                              "jae bf_flush\n"
+                              "ret\n"
+                              /* Returns eax from bf_main. */
+                              "bf_fail:\n"
+                              "mov rsp, rbx\n"
+                              "bf_return:\n"
+                              "add rsp, " NUMBER(OBJECT_FRAME_SIZE) "\n"
+                              "pop r15\n"
+                              "pop r14\n"
+                              "pop r13\n"
+                              "pop r12\n"
+                              "pop rbp\n"
+                              "pop rbx\n"
+                              "ret\n";
+
+const char runtime_map_loop[] = "bf_map_loop:\n"
+                                "mov r8b, dil\n"
+                                "mov r9b, sil\n"
+                                "test r9b, r9b\n"
+                                "jnz bf_map_read\n"
+                                /* Add and print the cell. */
+                                "bf_map_write:\n"
+                                "add r12b, r8b\n"
+                                "mov rax, [bf_out_len]\n"
+                                "mov [bf_out_buf + rax], r12b\n"
+                                "inc rax\n"
+                                "mov [bf_out_len], rax\n"
+                                "cmp rax, 65536\n"
+                                "jb bf_map_written\n"
+                                "call bf_flush\n"
+                                "bf_map_written:\n"
+                                "test r9b, r9b\n"
+                                "jnz bf_map_test\n"
+                                /* Read the next character, the cell is unchanged at the end of input. */
+                                "bf_map_read:\n"
+                                "mov rax, [bf_in_pos]\n"
+                                "cmp rax, [bf_in_len]\n"
+                                "jb bf_map_byte\n"
+                                "call bf_refill\n"
+                                "test rax, rax\n"
+                                "jz bf_map_read_end\n"
+                                "xor eax, eax\n"
+                                "bf_map_byte:\n"
+                                "mov r12b, [bf_in_buf + rax]\n"
+                                "inc rax\n"
+                                "mov [bf_in_pos], rax\n"
+                                "bf_map_read_end:\n"
+                                "test r9b, r9b\n"
+                                "jnz bf_map_write\n"
+                                "bf_map_test:\n"
+                                "test r12b, r12b\n"
+                                "jnz bf_map_next\n"
+                                "jmp bf_flush\n"
+                                "bf_map_next:\n"
+                                "test r9b, r9b\n"
+                                "jnz bf_map_read\n"
+                                "jmp bf_map_write\n";
+
+const char runtime_scan_sse2[] = "bf_scan_right_sse2:\n"
+                                 "lea r10, [r15 + rcx]\n"
+                                 "lea rdi, [r15 + r13]\n"
+                                 "pxor xmm0, xmm0\n"
+                                 /* The first block is shifted to start at the current cell. */
+                                 "bf_scan_right_sse2_block:\n"
+                                 "mov rcx, rdi\n"
+                                 "and rcx, 15\n"
+                                 "mov rax, rdi\n"
+                                 "sub rax, rcx\n"
+                                 "movdqa xmm1, [rax]\n"
+                                 "pcmpeqb xmm1, xmm0\n"
+                                 "pmovmskb edx, xmm1\n"
+                                 "shr edx, cl\n"
+                                 "test edx, edx\n"
+                                 "jnz bf_scan_right_sse2_found\n"
+                                 "lea rdi, [rax + 16]\n"
+                                 "bf_scan_right_sse2_next:\n"
+                                 "cmp rdi, r10\n"
+                                 "jae bf_scan_right_sse2_wrap\n"
+                                 "movdqa xmm1, [rdi]\n"
+                                 "pcmpeqb xmm1, xmm0\n"
+                                 "pmovmskb edx, xmm1\n"
+                                 "test edx, edx\n"
+                                 "jnz bf_scan_right_sse2_found\n"
+                                 "add rdi, 16\n"
+                                 "jmp bf_scan_right_sse2_next\n"
+                                 /* Zeros past the end of the stack continue from its start. */
+                                 "bf_scan_right_sse2_found:\n"
+                                 "bsf edx, edx\n"
+                                 "add rdi, rdx\n"
+                                 "cmp rdi, r10\n"
+                                 "jae bf_scan_right_sse2_wrap\n"
+                                 "sub rdi, r15\n"
+                                 "mov r13, rdi\n"
+                                 "ret\n"
+                                 "bf_scan_right_sse2_wrap:\n"
+                                 "mov rdi, r15\n"
+                                 "jmp bf_scan_right_sse2_block\n"
+                                 "bf_scan_left_sse2:\n"
+                                 "lea r10, [r15 + rcx - 1]\n"
+                                 "lea rdi, [r15 + r13]\n"
+                                 "pxor xmm0, xmm0\n"
+                                 /* The first block is shifted to end at the current cell. */
+                                 "bf_scan_left_sse2_block:\n"
+                                 "mov rcx, rdi\n"
+                                 "and rcx, 15\n"
+                                 "mov rax, rdi\n"
+                                 "sub rax, rcx\n"
+                                 "movdqa xmm1, [rax]\n"
+                                 "pcmpeqb xmm1, xmm0\n"
+                                 "pmovmskb edx, xmm1\n"
+                                 "xor ecx, 31\n"
+                                 "shl edx, cl\n"
+                                 "test edx, edx\n"
+                                 "jnz bf_scan_left_sse2_first\n"
+                                 "bf_scan_left_sse2_next:\n"
+                                 "cmp rax, r15\n"
+                                 "jbe bf_scan_left_sse2_wrap\n"
+                                 "sub rax, 16\n"
+                                 "movdqa xmm1, [rax]\n"
+                                 "pcmpeqb xmm1, xmm0\n"
+                                 "pmovmskb edx, xmm1\n"
+                                 "test edx, edx\n"
+                                 "jz bf_scan_left_sse2_next\n"
+                                 "bsr edx, edx\n"
+                                 "add rax, rdx\n"
+                                 "jmp bf_scan_left_sse2_found\n"
+                                 "bf_scan_left_sse2_first:\n"
+                                 "bsr edx, edx\n"
+                                 "lea rax, [rdi + rdx - 31]\n"
+                                 /* Zeros before the start of the stack continue from its end. */
+                                 "bf_scan_left_sse2_found:\n"
+                                 "cmp rax, r15\n"
+                                 "jb bf_scan_left_sse2_wrap\n"
+                                 "sub rax, r15\n"
+                                 "mov r13, rax\n"
+                                 "ret\n"
+                                 "bf_scan_left_sse2_wrap:\n"
+                                 "mov rdi, r10\n"
+                                 "jmp bf_scan_left_sse2_block\n";
+
+/* tzcnt runs as bsf on processors without BMI1, both are the same for masks that aren't 0. */
+const char runtime_scan_avx2[] = "bf_scan_right_avx2:\n"
+                                 "lea r10, [r15 + rcx]\n"
+                                 "lea rdi, [r15 + r13]\n"
+                                 "vpxor xmm0, xmm0, xmm0\n"
+                                 "bf_scan_right_avx2_block:\n"
+                                 "mov rcx, rdi\n"
+                                 "and rcx, 31\n"
+                                 "mov rax, rdi\n"
+                                 "sub rax, rcx\n"
+                                 "vpcmpeqb ymm1, ymm0, [rax]\n"
+                                 "vpmovmskb edx, ymm1\n"
+                                 "shr edx, cl\n"
+                                 "test edx, edx\n"
+                                 "jnz bf_scan_right_avx2_found\n"
+                                 "lea rdi, [rax + 32]\n"
+                                 "bf_scan_right_avx2_next:\n"
+                                 "cmp rdi, r10\n"
+                                 "jae bf_scan_right_avx2_wrap\n"
+                                 "vpcmpeqb ymm1, ymm0, [rdi]\n"
+                                 "vpmovmskb edx, ymm1\n"
+                                 "test edx, edx\n"
+                                 "jnz bf_scan_right_avx2_found\n"
+                                 "add rdi, 32\n"
+                                 "jmp bf_scan_right_avx2_next\n"
+                                 "bf_scan_right_avx2_found:\n"
+                                 "tzcnt edx, edx\n"
+                                 "add rdi, rdx\n"
+                                 "cmp rdi, r10\n"
+                                 "jae bf_scan_right_avx2_wrap\n"
+                                 "sub rdi, r15\n"
+                                 "mov r13, rdi\n"
+                                 "vzeroupper\n"
+                                 "ret\n"
+                                 "bf_scan_right_avx2_wrap:\n"
+                                 "mov rdi, r15\n"
+                                 "jmp bf_scan_right_avx2_block\n"
+                                 "bf_scan_left_avx2:\n"
+                                 "lea r10, [r15 + rcx - 1]\n"
+                                 "lea rdi, [r15 + r13]\n"
+                                 "vpxor xmm0, xmm0, xmm0\n"
+                                 "bf_scan_left_avx2_block:\n"
+                                 "mov rcx, rdi\n"
+                                 "and rcx, 31\n"
+                                 "mov rax, rdi\n"
+                                 "sub rax, rcx\n"
+                                 "vpcmpeqb ymm1, ymm0, [rax]\n"
+                                 "vpmovmskb edx, ymm1\n"
+                                 "xor ecx, 31\n"
+                                 "shl edx, cl\n"
+                                 "test edx, edx\n"
+                                 "jnz bf_scan_left_avx2_first\n"
+                                 "bf_scan_left_avx2_next:\n"
+                                 "cmp rax, r15\n"
+                                 "jbe bf_scan_left_avx2_wrap\n"
+                                 "sub rax, 32\n"
+                                 "vpcmpeqb ymm1, ymm0, [rax]\n"
+                                 "vpmovmskb edx, ymm1\n"
+                                 "test edx, edx\n"
+                                 "jz bf_scan_left_avx2_next\n"
+                                 "bsr edx, edx\n"
+                                 "add rax, rdx\n"
+                                 "jmp bf_scan_left_avx2_found\n"
+                                 "bf_scan_left_avx2_first:\n"
+                                 "bsr edx, edx\n"
+                                 "lea rax, [rdi + rdx - 31]\n"
+                                 "bf_scan_left_avx2_found:\n"
+                                 "cmp rax, r15\n"
+                                 "jb bf_scan_left_avx2_wrap\n"
+                                 "sub rax, r15\n"
+                                 "mov r13, rax\n"
+                                 "vzeroupper\n"
+                                 "ret\n"
+                                 "bf_scan_left_avx2_wrap:\n"
+                                 "mov rdi, r10\n"
+                                 "jmp bf_scan_left_avx2_block\n";
+
+/* Masks of zero bytes come from vptestnmb in k1, 64 bits at a time. */
+const char runtime_scan_avx512[] = "bf_scan_right_avx512:\n"
+                                   "lea r10, [r15 + rcx]\n"
+                                   "lea rdi, [r15 + r13]\n"
+                                   "bf_scan_right_avx512_block:\n"
+                                   "mov rcx, rdi\n"
+                                   "and rcx, 63\n"
+                                   "mov rax, rdi\n"
+                                   "sub rax, rcx\n"
+                                   "vmovdqa64 zmm1, [rax]\n"
+                                   "vptestnmb k1, zmm1, zmm1\n"
+                                   "kmovq rdx, k1\n"
+                                   "shr rdx, cl\n"
+                                   "test rdx, rdx\n"
+                                   "jnz bf_scan_right_avx512_found\n"
+                                   "lea rdi, [rax + 64]\n"
+                                   "bf_scan_right_avx512_next:\n"
+                                   "cmp rdi, r10\n"
+                                   "jae bf_scan_right_avx512_wrap\n"
+                                   "vmovdqa64 zmm1, [rdi]\n"
+                                   "vptestnmb k1, zmm1, zmm1\n"
+                                   "kortestq k1, k1\n"
+                                   "jnz bf_scan_right_avx512_mask\n"
+                                   "add rdi, 64\n"
+                                   "jmp bf_scan_right_avx512_next\n"
+                                   "bf_scan_right_avx512_mask:\n"
+                                   "kmovq rdx, k1\n"
+                                   "bf_scan_right_avx512_found:\n"
+                                   "tzcnt rdx, rdx\n"
+                                   "add rdi, rdx\n"
+                                   "cmp rdi, r10\n"
+                                   "jae bf_scan_right_avx512_wrap\n"
+                                   "sub rdi, r15\n"
+                                   "mov r13, rdi\n"
+                                   "vzeroupper\n"
+                                   "ret\n"
+                                   "bf_scan_right_avx512_wrap:\n"
+                                   "mov rdi, r15\n"
+                                   "jmp bf_scan_right_avx512_block\n"
+                                   "bf_scan_left_avx512:\n"
+                                   "lea r10, [r15 + rcx - 1]\n"
+                                   "lea rdi, [r15 + r13]\n"
+                                   "bf_scan_left_avx512_block:\n"
+                                   "mov rcx, rdi\n"
+                                   "and rcx, 63\n"
+                                   "mov rax, rdi\n"
+                                   "sub rax, rcx\n"
+                                   "vmovdqa64 zmm1, [rax]\n"
+                                   "vptestnmb k1, zmm1, zmm1\n"
+                                   "kmovq rdx, k1\n"
+                                   "xor ecx, 63\n"
+                                   "shl rdx, cl\n"
+                                   "test rdx, rdx\n"
+                                   "jnz bf_scan_left_avx512_first\n"
+                                   "bf_scan_left_avx512_next:\n"
+                                   "cmp rax, r15\n"
+                                   "jbe bf_scan_left_avx512_wrap\n"
+                                   "sub rax, 64\n"
+                                   "vmovdqa64 zmm1, [rax]\n"
+                                   "vptestnmb k1, zmm1, zmm1\n"
+                                   "kortestq k1, k1\n"
+                                   "jz bf_scan_left_avx512_next\n"
+                                   "kmovq rdx, k1\n"
+                                   "bsr rdx, rdx\n"
+                                   "add rax, rdx\n"
+                                   "jmp bf_scan_left_avx512_found\n"
+                                   "bf_scan_left_avx512_first:\n"
+                                   "bsr rdx, rdx\n"
+                                   "lea rax, [rdi + rdx - 63]\n"
+                                   "bf_scan_left_avx512_found:\n"
+                                   "cmp rax, r15\n"
+                                   "jb bf_scan_left_avx512_wrap\n"
+                                   "sub rax, r15\n"
+                                   "mov r13, rax\n"
+                                   "vzeroupper\n"
+                                   "ret\n"
+                                   "bf_scan_left_avx512_wrap:\n"
+                                   "mov rdi, r10\n"
+                                   "jmp bf_scan_left_avx512_block\n";
+
+/*
+ * AVX2 needs the OSXSAVE and AVX bits of cpuid leaf 1 and XCR0 saving xmm and ymm registers,
+ * AVX-512BW the F and BW bits of leaf 7 and XCR0 also saving k and zmm registers.
+ * Addresses are relative to the return address of a call, so that objects stay position independent.
+ */
+const char runtime_scan_dispatch[] = "bf_scan_dispatch:\n"
+                                     "push rbx\n"
+                                     "call bf_scan_base\n"
+                                     "bf_scan_base:\n"
+                                     "pop r11\n"
+                                     "lea r8, [r11 + bf_scan_right_sse2 - bf_scan_base]\n"
+                                     "lea r9, [r11 + bf_scan_left_sse2 - bf_scan_base]\n"
+                                     "xor eax, eax\n"
+                                     "cpuid\n"
+                                     "cmp eax, 7\n"
+                                     "jb bf_scan_dispatched\n"
+                                     "mov eax, 1\n"
+                                     "cpuid\n"
+                                     "and ecx, 0x18000000\n"
+                                     "cmp ecx, 0x18000000\n"
+                                     "jne bf_scan_dispatched\n"
+                                     "xor ecx, ecx\n"
+                                     "xgetbv\n"
+                                     "mov r10d, eax\n"
+                                     "mov eax, 7\n"
+                                     "xor ecx, ecx\n"
+                                     "cpuid\n"
+                                     "mov eax, r10d\n"
+                                     "and eax, 6\n"
+                                     "cmp eax, 6\n"
+                                     "jne bf_scan_dispatched\n"
+                                     "test ebx, 0x20\n"
+                                     "jz bf_scan_dispatched\n"
+                                     "lea r8, [r11 + bf_scan_right_avx2 - bf_scan_base]\n"
+                                     "lea r9, [r11 + bf_scan_left_avx2 - bf_scan_base]\n"
+                                     "and r10d, 0xe6\n"
+                                     "cmp r10d, 0xe6\n"
+                                     "jne bf_scan_dispatched\n"
+                                     "and ebx, 0x40010000\n"
+                                     "cmp ebx, 0x40010000\n"
+                                     "jne bf_scan_dispatched\n"
+                                     "lea r8, [r11 + bf_scan_right_avx512 - bf_scan_base]\n"
+                                     "lea r9, [r11 + bf_scan_left_avx512 - bf_scan_base]\n"
+                                     "bf_scan_dispatched:\n"
+                                     "mov [rdi], r8\n"
+                                     "mov [rdi + 8], r9\n"
+                                     "pop rbx\n"
+                                     "ret\n";
+
+const char runtime_number[] = "bf_number:\n"
+                              "sub rsp, 32\n"
+                              "lea rdi, [rsp + 31]\n"
+                              "mov cl, 10\n"
+                              "mov [rdi], cl\n"
+                              "mov ecx, 10\n"
+                              "bf_number_digit:\n"
+                              "xor edx, edx\n"
+                              "div rcx\n"
+                              "add dl, 48\n"
+                              "dec rdi\n"
+                              "mov [rdi], dl\n"
+                              "test rax, rax\n"
+                              "jnz bf_number_digit\n"
+                              "lea rdx, [rsp + 32]\n"
+                              "sub rdx, rdi\n"
+                              "mov rsi, rdi\n"
+                              "mov eax, 1\n"
+                              "mov edi, 2\n"
+                              "syscall\n"
+                              "add rsp, 32\n"
+                              "ret\n";
+
+_Static_assert((1 << (64 - MEMO_HASH_SHIFT)) == MEMO_ENTRIES, "runtime_memo selects entries by the top bits");
+_Static_assert(sizeof(MEMO_HITS_TEXT) == 12 && sizeof(MEMO_MISSES_TEXT) == 14,
+    "runtime_memo writes 11 and 13 bytes");
+
+const RuntimeData runtime_memo_data[] = {
+    { "bf_memo_hits", 8 },
+    { "bf_memo_misses", 8 },
+    { NULL, 0 }
+};
+
+const char runtime_memo[] = "bf_memo_find:\n"
+                            "mov r8, rdi\n"
+                            "mov r9, rsi\n"
+                            "mov r10, rdx\n"
+                            "mov r11, rcx\n"
+                            /* FNV-1a hash of the window. */
+                            "mov rax, 0xcbf29ce484222325\n"
+                            "mov rdx, 0x100000001b3\n"
+                            "xor ecx, ecx\n"
+                            "bf_memo_hash:\n"
+                            "xor al, [r8 + rcx]\n"
+                            "imul rax, rdx\n"
+                            "inc rcx\n"
+                            "cmp rcx, r10\n"
+                            "jb bf_memo_hash\n"
+                            /* The entry is selected by the top bits of the hash. */
+                            "shr rax, " NUMBER(MEMO_HASH_SHIFT) "\n"
+                            "imul rax, r11\n"
+                            "lea rdi, [r9 + 8 + rax]\n"
+                            "mov [r9], rdi\n"
+                            "mov rax, [rdi]\n"
+                            "test rax, rax\n"
+                            "jz bf_memo_miss\n"
+                            "add rdi, 8\n"
+                            "mov rsi, r8\n"
+                            "mov rcx, r10\n"
+                            "repe cmpsb\n"
+                            "jne bf_memo_miss\n"
+                            /* Replace the window by the state after the loop, which follows the key. */
+                            "mov rsi, [r9]\n"
+                            "lea rcx, [r11 - 8]\n"
+                            "shr rcx, 1\n"
+                            "lea rsi, [rsi + 8 + rcx]\n"
+                            "mov rdi, r8\n"
+                            "mov rcx, r10\n"
+                            "rep movsb\n"
+                            "xor eax, eax\n"
+                            "mov [r9], rax\n"
+                            "mov rax, [bf_memo_hits]\n"
+                            "inc rax\n"
+                            "mov [bf_memo_hits], rax\n"
+                            "mov eax, 1\n"
+                            "ret\n"
+                            /* Save the key, the entry is invalid until bf_memo_store. */
+                            "bf_memo_miss:\n"
+                            "mov rdi, [r9]\n"
+                            "xor eax, eax\n"
+                            "mov [rdi], rax\n"
+                            "add rdi, 8\n"
+                            "mov rsi, r8\n"
+                            "mov rcx, r10\n"
+                            "rep movsb\n"
+                            "mov rax, [bf_memo_misses]\n"
+                            "inc rax\n"
+                            "mov [bf_memo_misses], rax\n"
+                            "xor eax, eax\n"
+                            "ret\n"
+                            "bf_memo_store:\n"
+                            "mov rax, [rsi]\n"
+                            "test rax, rax\n"
+                            "jz bf_memo_stored\n"
+                            "xor r8d, r8d\n"
+                            "mov [rsi], r8\n"
+                            "lea r9, [rcx - 8]\n"
+                            "shr r9, 1\n"
+                            "mov rsi, rdi\n"
+                            "lea rdi, [rax + 8 + r9]\n"
+                            "mov rcx, rdx\n"
+                            "rep movsb\n"
+                            "mov ecx, 1\n"
+                            "mov [rax], rcx\n"
+                            "bf_memo_stored:\n"
+                            "ret\n"
+                            "bf_memo_report:\n"
+                            "mov eax, 1\n"
+                            "mov edi, 2\n"
+                            "lea rsi, [bf_memo_hits_text]\n"
+                            "mov edx, 11\n"
+                            "syscall\n"
+                            "mov rax, [bf_memo_hits]\n"
+                            "call bf_number\n"
+                            "mov eax, 1\n"
+                            "mov edi, 2\n"
+                            "lea rsi, [bf_memo_misses_text]\n"
+                            "mov edx, 13\n"
+                            "syscall\n"
+                            "mov rax, [bf_memo_misses]\n"
+                            "jmp bf_number\n";
+
+/* Offsets of registers in ucontext_t passed to signal handlers. */
+#define UCONTEXT_R13 80
+#define UCONTEXT_RBP 120
+#define UCONTEXT_RBX 128
+#define UCONTEXT_RSP 160
+#define UCONTEXT_RIP 168
+
+const RuntimeData runtime_introspect_data[] = {
+    { "bf_reads", 8 },
+    { "bf_writes", 8 },
+    { NULL, 0 }
+};
+
+const char runtime_introspect[] = /* rt_sigaction(SIGUSR1) with SA_SIGINFO, SA_RESTART and SA_RESTORER. */
+                                  "bf_introspect_install:\n"
+                                  "sub rsp, 32\n"
+                                  "lea rax, [bf_introspect]\n"
+                                  "mov [rsp], rax\n"
+                                  "mov rax, 0x14000004\n"
+                                  "mov [rsp + 8], rax\n"
+                                  "lea rax, [bf_introspect_return]\n"
+                                  "mov [rsp + 16], rax\n"
+                                  "xor eax, eax\n"
+                                  "mov [rsp + 24], rax\n"
+                                  "mov eax, 13\n"
+                                  "mov edi, 10\n"
+                                  "mov rsi, rsp\n"
+                                  "xor edx, edx\n"
+                                  "mov r10d, 8\n"
+                                  "syscall\n"
+                                  "add rsp, 32\n"
+                                  "ret\n"
+                                  "bf_introspect_return:\n"
+                                  "mov eax, 15\n"
+                                  "syscall\n"
+                                  /* Values of the report are stored at rsp and its text after them. */
+                                  "bf_introspect:\n"
+                                  "mov r10, rdx\n"
+                                  "sub rsp, 320\n"
+                                  /* Position of the last instruction starting before the interrupted one. */
+                                  "mov rax, [r10 + " NUMBER(UCONTEXT_RIP) "]\n"
+                                  "lea rcx, [bf_pos_runtime]\n"
+                                  "cmp rax, rcx\n"
+                                  "jb bf_introspect_search\n"
+                                  /* In runtime routines use the innermost return address to the code. */
+                                  "lea rdx, [_start]\n"
+                                  "mov rsi, [r10 + " NUMBER(UCONTEXT_RSP) "]\n"
+                                  "lea rdi, [rsi + 64]\n"
+                                  "bf_introspect_caller:\n"
+                                  "cmp rsi, rdi\n"
+                                  "jae bf_introspect_search\n"
+                                  "mov r8, [rsi]\n"
+                                  "add rsi, 8\n"
+                                  "cmp r8, rcx\n"
+                                  "jae bf_introspect_caller\n"
+                                  "cmp r8, rdx\n"
+                                  "jb bf_introspect_caller\n"
+                                  "mov rax, r8\n"
+                                  "bf_introspect_search:\n"
+                                  "lea rsi, [bf_positions]\n"
+                                  "lea rdi, [bf_positions_end]\n"
+                                  "xor r8d, r8d\n"
+                                  "xor r9d, r9d\n"
+                                  /* Entries are sorted by address. */
+                                  "bf_introspect_find:\n"
+                                  "cmp rsi, rdi\n"
+                                  "jae bf_introspect_found\n"
+                                  "cmp [rsi], rax\n"
+                                  "ja bf_introspect_found\n"
+                                  "mov r8, [rsi + 8]\n"
+                                  "mov r9, [rsi + 16]\n"
+                                  "add rsi, 24\n"
+                                  "jmp bf_introspect_find\n"
+                                  "bf_introspect_found:\n"
+                                  "mov [rsp], r8\n"
+                                  "mov [rsp + 8], r9\n"
+                                  "mov rax, [r10 + " NUMBER(UCONTEXT_R13) "]\n"
+                                  "xor edx, edx\n"
+                                  "mov rcx, [bf_cell_size]\n"
+                                  "div rcx\n"
+                                  "mov [rsp + 16], rax\n"
+                                  "mov rax, [r10 + " NUMBER(UCONTEXT_RBX) "]\n"
+                                  "mov [rsp + 24], rax\n"
+                                  "mov rax, [bf_reads]\n"
+                                  "mov [rsp + 32], rax\n"
+                                  "mov rax, [bf_writes]\n"
+                                  "mov [rsp + 40], rax\n"
+                                  /* Copy the format up to the newline, replacing # by the values. */
+                                  "lea rsi, [bf_introspect_format]\n"
+                                  "lea rdi, [rsp + 48]\n"
+                                  "mov r8, rsp\n"
+                                  "bf_introspect_char:\n"
+                                  "mov al, [rsi]\n"
+                                  "inc rsi\n"
+                                  "cmp al, 35\n"
+                                  "je bf_introspect_number\n"
+                                  "mov [rdi], al\n"
+                                  "inc rdi\n"
+                                  "cmp al, 10\n"
+                                  "jne bf_introspect_char\n"
+                                  "jmp bf_introspect_write\n"
+                                  /* Digits are written from the lowest one and reversed. */
+                                  "bf_introspect_number:\n"
+                                  "mov rax, [r8]\n"
+                                  "add r8, 8\n"
+                                  "mov r9, rdi\n"
+                                  "mov ecx, 10\n"
+                                  "bf_introspect_digit:\n"
+                                  "xor edx, edx\n"
+                                  "div rcx\n"
+                                  "add dl, 48\n"
+                                  "mov [rdi], dl\n"
+                                  "inc rdi\n"
+                                  "test rax, rax\n"
+                                  "jnz bf_introspect_digit\n"
+                                  "lea rdx, [rdi - 1]\n"
+                                  "bf_introspect_reverse:\n"
+                                  "cmp r9, rdx\n"
+                                  "jae bf_introspect_char\n"
+                                  "mov al, [r9]\n"
+                                  "mov cl, [rdx]\n"
+                                  "mov [r9], cl\n"
+                                  "mov [rdx], al\n"
+                                  "inc r9\n"
+                                  "dec rdx\n"
+                                  "jmp bf_introspect_reverse\n"
+                                  /* Write to stderr or append to the file. */
+                                  "bf_introspect_write:\n"
+                                  "lea rsi, [rsp + 48]\n"
+                                  "mov r9, rdi\n"
+                                  "sub r9, rsi\n"
+                                  "mov r8d, 2\n"
+                                  "lea rdi, [bf_introspect_path]\n"
+                                  "mov al, [rdi]\n"
+                                  "test al, al\n"
+                                  "jz bf_introspect_output\n"
+                                  "mov esi, 0x441\n"
+                                  "mov edx, 0x1a4\n"
+                                  "mov eax, 2\n"
+                                  "syscall\n"
+                                  "test rax, rax\n"
+                                  "js bf_introspect_end\n"
+                                  "mov r8, rax\n"
+                                  "bf_introspect_output:\n"
+                                  "mov rdi, r8\n"
+                                  "lea rsi, [rsp + 48]\n"
+                                  "mov rdx, r9\n"
+                                  "mov eax, 1\n"
+                                  "syscall\n"
+                                  "cmp r8, 2\n"
+                                  "je bf_introspect_end\n"
+                                  "mov rdi, r8\n"
+                                  "mov eax, 3\n"
+                                  "syscall\n"
+                                  "bf_introspect_end:\n"
+                                  "add rsp, 320\n"
+                                  "ret\n";
+
+/* Texts with the newline and labels without it. */
+_Static_assert(sizeof(LIMIT_STEPS_TEXT) == 24 && sizeof(LIMIT_OUTPUT_TEXT) == 26 && sizeof(LIMIT_TIME_TEXT) == 24,
+    "runtime_limit writes 24, 26 and 24 bytes");
+_Static_assert(sizeof(LIMIT_STEPS_LABEL) == 8 && sizeof(LIMIT_OUTPUT_LABEL) == 15,
+    "runtime_limit writes 7 and 14 bytes");
+
+const RuntimeData runtime_limit_data[] = {
+    { "bf_output_left", 8 },
+    { NULL, 0 }
+};
+
+const char runtime_limit[] = /* rt_sigaction(SIGALRM) with SA_SIGINFO and SA_RESTORER, the handler never returns. */
+                             "bf_limit_timer:\n"
+                             "push rdi\n"
+                             "push rsi\n"
+                             "sub rsp, 32\n"
+                             "lea rax, [bf_limit_time]\n"
+                             "mov [rsp], rax\n"
+                             "mov eax, 0x04000004\n"
+                             "mov [rsp + 8], rax\n"
+                             "lea rax, [bf_limit_time]\n"
+                             "mov [rsp + 16], rax\n"
+                             "xor eax, eax\n"
+                             "mov [rsp + 24], rax\n"
+                             "mov eax, 13\n"
+                             "mov edi, 14\n"
+                             "mov rsi, rsp\n"
+                             "xor edx, edx\n"
+                             "mov r10d, 8\n"
+                             "syscall\n"
+                             /* setitimer(ITIMER_REAL) without an interval. */
+                             "xor eax, eax\n"
+                             "mov [rsp], rax\n"
+                             "mov [rsp + 8], rax\n"
+                             "mov rax, [rsp + 40]\n"
+                             "mov [rsp + 16], rax\n"
+                             "mov rax, [rsp + 32]\n"
+                             "mov [rsp + 24], rax\n"
+                             "mov eax, 38\n"
+                             "xor edi, edi\n"
+                             "mov rsi, rsp\n"
+                             "xor edx, edx\n"
+                             "syscall\n"
+                             "add rsp, 48\n"
+                             "ret\n"
+                             /* The step counter is taken from the interrupted code. */
+                             "bf_limit_time:\n"
+                             "mov rbp, [rdx + " NUMBER(UCONTEXT_RBP) "]\n"
+                             "lea rsi, [bf_limit_time_text]\n"
+                             "mov edx, 24\n"
+                             "mov r12d, " NUMBER(LIMIT_STATUS_TIME) "\n"
+                             "jmp bf_limit_report\n"
+                             /* The character that didn't fit wasn't written. */
+                             "bf_limit_output:\n"
+                             "mov rax, [bf_output_left]\n"
+                             "inc rax\n"
+                             "mov [bf_output_left], rax\n"
+                             "lea rsi, [bf_limit_output_text]\n"
+                             "mov edx, 26\n"
+                             "mov r12d, " NUMBER(LIMIT_STATUS_OUTPUT) "\n"
+                             "jmp bf_limit_report\n"
+                             "bf_limit_steps:\n"
+                             "lea rsi, [bf_limit_steps_text]\n"
+                             "mov edx, 24\n"
+                             "mov r12d, " NUMBER(LIMIT_STATUS_STEPS) "\n"
+                             "bf_limit_report:\n"
+                             "mov eax, 1\n"
+                             "mov edi, 2\n"
+                             "syscall\n"
+                             "mov eax, 1\n"
+                             "mov edi, 2\n"
+                             "lea rsi, [bf_limit_steps_label]\n"
+                             "mov edx, 7\n"
+                             "syscall\n"
+                             "mov rax, [bf_limit_budget]\n"
+                             "sub rax, rbp\n"
+                             "call bf_number\n"
+                             "mov eax, 1\n"
+                             "mov edi, 2\n"
+                             "lea rsi, [bf_limit_output_label]\n"
+                             "mov edx, 14\n"
+                             "syscall\n"
+                             "mov rax, [bf_limit_budget + 8]\n"
+                             "sub rax, [bf_output_left]\n"
+                             "call bf_number\n"
+                             "mov eax, 231\n"
+                             "mov edi, r12d\n"
+                             "syscall\n";
+
+/*
+ * The frame holds msghdr at rsp, iovec at rsp + 56, the request byte and the wait status at rsp + 72
+ * and the control message at rsp + 80 with descriptors of the request at rsp + 96 and rsp + 100.
+ * r8 counts requests and r9 holds the child, system calls keep both.
+ */
+const char runtime_fork_server[] = "bf_fork_server:\n"
+                                   "sub rsp, 104\n"
+                                   "xor r8d, r8d\n"
+                                   /* recvmsg(FORK_SERVER_FD, msghdr, 0) */
+                                   "bf_fork_server_next:\n"
+                                   "xor eax, eax\n"
+                                   "mov [rsp], rax\n"
+                                   "mov [rsp + 8], rax\n"
+                                   "mov [rsp + 48], rax\n"
+                                   "mov [rsp + 80], rax\n"
+                                   "lea rax, [rsp + 56]\n"
+                                   "mov [rsp + 16], rax\n"
+                                   "mov eax, 1\n"
+                                   "mov [rsp + 24], rax\n"
+                                   "mov [rsp + 64], rax\n"
+                                   "lea rax, [rsp + 80]\n"
+                                   "mov [rsp + 32], rax\n"
+                                   "mov eax, 24\n"
+                                   "mov [rsp + 40], rax\n"
+                                   "lea rax, [rsp + 72]\n"
+                                   "mov [rsp + 56], rax\n"
+                                   "mov eax, 47\n"
+                                   "mov edi, " NUMBER(FORK_SERVER_FD) "\n"
+                                   "mov rsi, rsp\n"
+                                   "xor edx, edx\n"
+                                   "syscall\n"
+                                   "cmp rax, -4\n"
+                                   "je bf_fork_server_next\n"
+                                   "test rax, rax\n"
+                                   "jg bf_fork_server_request\n"
+                                   "jz bf_fork_server_exit\n"
+                                   /* Errors before the first request mean there is no server. */
+                                   "test r8, r8\n"
+                                   "jz bf_fork_server_run\n"
+                                   "bf_fork_server_exit:\n"
+                                   "mov eax, 231\n"
+                                   "xor edi, edi\n"
+                                   "syscall\n"
+                                   /* Requests that aren't run report status -1. */
+                                   "bf_fork_server_request:\n"
+                                   "inc r8\n"
+                                   "mov eax, -1\n"
+                                   "mov [rsp + 76], eax\n"
+                                   "mov rcx, [rsp + 40]\n"
+                                   "test rcx, rcx\n"
+                                   "jz bf_fork_server_inherit\n"
+                                   /* Otherwise the control message must be SCM_RIGHTS with exactly two descriptors. */
+                                   "cmp rcx, 16\n"
+                                   "jb bf_fork_server_status\n"
+                                   "mov eax, [rsp + 88]\n"
+                                   "cmp eax, 1\n"
+                                   "jne bf_fork_server_status\n"
+                                   "mov eax, [rsp + 92]\n"
+                                   "cmp eax, 1\n"
+                                   "jne bf_fork_server_status\n"
+                                   "mov rcx, [rsp + 80]\n"
+                                   "cmp rcx, 24\n"
+                                   "jne bf_fork_server_malformed\n"
+                                   "mov eax, [rsp + 48]\n"
+                                   "test eax, 8\n"
+                                   "jz bf_fork_server_fork\n"
+                                   /* Closes the (cmsg_len - 16) / 4 descriptors received with a malformed request. */
+                                   "bf_fork_server_malformed:\n"
+                                   "mov eax, -1\n"
+                                   "cmp rcx, 24\n"
+                                   "jae bf_fork_server_discard\n"
+                                   "mov [rsp + 100], eax\n"
+                                   "cmp rcx, 20\n"
+                                   "jae bf_fork_server_discard\n"
+                                   "mov [rsp + 96], eax\n"
+                                   "bf_fork_server_discard:\n"
+                                   "xor edx, edx\n"
+                                   "call bf_fork_server_close\n"
+                                   "jmp bf_fork_server_status\n"
+                                   /* Without a control message the run keeps standard input and output of the server. */
+                                   "bf_fork_server_inherit:\n"
+                                   "mov [rsp + 96], eax\n"
+                                   "mov [rsp + 100], eax\n"
+                                   "bf_fork_server_fork:\n"
+                                   "mov eax, 57\n"
+                                   "syscall\n"
+                                   "test rax, rax\n"
+                                   "jz bf_fork_server_child\n"
+                                   "mov r9, rax\n"
+                                   "xor edx, edx\n"
+                                   "call bf_fork_server_close\n"
+                                   /* wait4(child, status, 0, NULL), a failed fork leaves status -1. */
+                                   "test r9, r9\n"
+                                   "js bf_fork_server_status\n"
+                                   "bf_fork_server_wait:\n"
+                                   "mov eax, 61\n"
+                                   "mov rdi, r9\n"
+                                   "lea rsi, [rsp + 76]\n"
+                                   "xor edx, edx\n"
+                                   "xor r10d, r10d\n"
+                                   "syscall\n"
+                                   "cmp rax, -4\n"
+                                   "je bf_fork_server_wait\n"
+                                   "bf_fork_server_status:\n"
+                                   "mov eax, 1\n"
+                                   "mov edi, " NUMBER(FORK_SERVER_FD) "\n"
+                                   "lea rsi, [rsp + 76]\n"
+                                   "mov edx, 4\n"
+                                   "syscall\n"
+                                   "cmp rax, 4\n"
+                                   "jne bf_fork_server_exit\n"
+                                   "jmp bf_fork_server_next\n"
+                                   /* dup2 the descriptors of the request to 0 and 1. */
+                                   "bf_fork_server_child:\n"
+                                   "mov edi, [rsp + 96]\n"
+                                   "test edi, edi\n"
+                                   "js bf_fork_server_output\n"
+                                   "mov eax, 33\n"
+                                   "xor esi, esi\n"
+                                   "syscall\n"
+                                   "bf_fork_server_output:\n"
+                                   "mov edi, [rsp + 100]\n"
+                                   "test edi, edi\n"
+                                   "js bf_fork_server_closed\n"
+                                   "mov eax, 33\n"
+                                   "mov esi, 1\n"
+                                   "syscall\n"
+                                   "bf_fork_server_closed:\n"
+                                   "mov edx, 3\n"
+                                   "call bf_fork_server_close\n"
+                                   "mov eax, 3\n"
+                                   "mov edi, " NUMBER(FORK_SERVER_FD) "\n"
+                                   "syscall\n"
+                                   "bf_fork_server_run:\n"
+                                   "add rsp, 104\n"
+                                   "ret\n"
+                                   /* Closes descriptors of the request from edx up, the child keeps 0, 1 and 2. */
+                                   "bf_fork_server_close:\n"
+                                   "mov edi, [rsp + 104]\n"
+                                   "cmp edi, edx\n"
+                                   "jl bf_fork_server_input_kept\n"
+                                   "mov eax, 3\n"
+                                   "syscall\n"
+                                   "bf_fork_server_input_kept:\n"
+                                   "mov edi, [rsp + 108]\n"
+                                   "cmp edi, edx\n"
+                                   "jl bf_fork_server_output_kept\n"
+                                   "mov eax, 3\n"
+                                   "syscall\n"
+                                   "bf_fork_server_output_kept:\n"
+                                   "ret\n";
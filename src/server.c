@@ -0,0 +1,417 @@
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "functions.h"
+#include "server.h"
+
+/* Largest request accepted by the server in bytes. */
+#define REQUEST_LIMIT (1 << 20)
+
+/* Number of descriptors passed with a request, standard input, output and error. */
+#define REQUEST_DESCRIPTORS 3
+
+/* Seconds a client has to send its whole request before the connection is dropped. */
+#define REQUEST_TIMEOUT 5
+
+/* Set by signal handlers when the server should stop. */
+static volatile sig_atomic_t stopping = 0;
+
+static void stop(int signal)
+{
+    stopping = 1;
+}
+
+/*
+ * Fills addr with path of the socket.
+ */
+static void socket_address(struct sockaddr_un *addr, const char *path)
+{
+    if (strlen(path) >= sizeof(addr->sun_path))
+        die("Socket path is too long.");
+
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    strcpy(addr->sun_path, path);
+}
+
+/*
+ * Writes the whole buffer to a descriptor.
+ *
+ * @return          0 on success, -1 on error.
+ */
+static int write_all(int fd, const void *data, size_t length)
+{
+    const char *bytes = data;
+    while (length) {
+        ssize_t written = write(fd, bytes, length);
+        if (written < 0 && errno == EINTR)
+            continue;
+        if (written <= 0)
+            return -1;
+        bytes += written;
+        length -= written;
+    }
+    return 0;
+}
+
+/*
+ * Limits the time reads of a socket block to what is left until the deadline.
+ *
+ * @return          0 on success, -1 if the deadline has passed or on error.
+ */
+static int set_deadline(int fd, const struct timespec *deadline)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    long long left = (deadline->tv_sec - now.tv_sec) * 1000000LL + (deadline->tv_nsec - now.tv_nsec) / 1000;
+    if (left <= 0)
+        return -1;
+
+    struct timeval timeout = { .tv_sec = left / 1000000, .tv_usec = left % 1000000 };
+    return setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+}
+
+/*
+ * Reads exactly length bytes from a descriptor.
+ *
+ * @param   deadline    Time by which the socket must have sent all bytes, NULL to wait indefinitely.
+ * @return              0 on success, -1 on error, end of file or timeout.
+ */
+static int read_all(int fd, void *data, size_t length, const struct timespec *deadline)
+{
+    char *bytes = data;
+    while (length) {
+        if (deadline && set_deadline(fd, deadline))
+            return -1;
+        ssize_t count = read(fd, bytes, length);
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0)
+            return -1;
+        bytes += count;
+        length -= count;
+    }
+    return 0;
+}
+
+/*
+ * Closes all descriptors received with a message.
+ */
+static void close_received(struct msghdr *message)
+{
+    for (struct cmsghdr *cmsg = CMSG_FIRSTHDR(message); cmsg; cmsg = CMSG_NXTHDR(message, cmsg)) {
+        if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+            continue;
+
+        size_t count = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+        for (size_t i = 0; i < count; ++i) {
+            int fd;
+            memcpy(&fd, CMSG_DATA(cmsg) + i * sizeof(int), sizeof(fd));
+            close(fd);
+        }
+    }
+}
+
+/*
+ * Handles a single connection.
+ *
+ * A request starts with its length as uint32_t sent together with
+ * the client's standard descriptors, followed by the current directory
+ * and the arguments, each terminated by '\0'.
+ * The response is the exit status as int32_t.
+ * Connections that don't send the whole request within REQUEST_TIMEOUT are dropped.
+ */
+static void handle_connection(int connection, int listener, RequestHandler handler)
+{
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += REQUEST_TIMEOUT;
+    if (set_deadline(connection, &deadline))
+        return;
+
+    uint32_t length;
+    int fds[REQUEST_DESCRIPTORS];
+    char control[CMSG_SPACE(sizeof(fds))];
+
+    struct iovec iov = { .iov_base = &length, .iov_len = sizeof(length) };
+    struct msghdr message = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control,
+        .msg_controllen = sizeof(control)
+    };
+
+    ssize_t received = recvmsg(connection, &message, MSG_WAITALL);
+    if (received != sizeof(length)) {
+        if (received >= 0)
+            close_received(&message);
+        return;
+    }
+
+    /* Descriptors of a malformed request are closed, as the worker handles connections indefinitely. */
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+    if (!cmsg || cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS
+        || cmsg->cmsg_len != CMSG_LEN(sizeof(fds))) {
+        close_received(&message);
+        return;
+    }
+    memcpy(fds, CMSG_DATA(cmsg), sizeof(fds));
+
+    char *request = NULL;
+    if (length && length <= REQUEST_LIMIT)
+        request = malloc(length + 1);
+
+    if (!request || read_all(connection, request, length, &deadline)) {
+        free(request);
+        for (int i = 0; i < REQUEST_DESCRIPTORS; ++i)
+            close(fds[i]);
+        return;
+    }
+    request[length] = '\0';
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        /* Run the request as if the client ran it. */
+        close(listener);
+        close(connection);
+        for (int i = 0; i < REQUEST_DESCRIPTORS; ++i) {
+            dup2(fds[i], i);
+            close(fds[i]);
+        }
+        signal(SIGINT, SIG_DFL);
+        signal(SIGTERM, SIG_DFL);
+        signal(SIGPIPE, SIG_DFL);
+
+        if (chdir(request))
+            die("Failed to change directory of the request.");
+
+        /* Split arguments following the directory. */
+        size_t argc = 0;
+        for (size_t i = strlen(request) + 1; i < length; i += strlen(request + i) + 1)
+            ++argc;
+
+        char **argv = malloc((argc + 1) * sizeof(char *));
+        if (!argv)
+            die("Memory allocation failed.");
+
+        argc = 0;
+        for (size_t i = strlen(request) + 1; i < length; i += strlen(request + i) + 1)
+            argv[argc++] = request + i;
+        argv[argc] = NULL;
+
+        exit(handler(argc, argv));
+    }
+
+    free(request);
+    for (int i = 0; i < REQUEST_DESCRIPTORS; ++i)
+        close(fds[i]);
+
+    /* A request that couldn't be forked or waited for is reported as failed. */
+    int32_t status = 1;
+    int wait_status = 0;
+    if (pid > 0) {
+        pid_t waited;
+        while ((waited = waitpid(pid, &wait_status, 0)) < 0 && errno == EINTR)
+            ;
+        if (waited != pid)
+            status = 1;
+        else if (WIFEXITED(wait_status))
+            status = WEXITSTATUS(wait_status);
+        else if (WIFSIGNALED(wait_status))
+            status = 128 + WTERMSIG(wait_status);
+    }
+
+    write_all(connection, &status, sizeof(status));
+}
+
+/*
+ * Accepts and handles connections until the server stops.
+ */
+static void work(int listener, RequestHandler handler)
+{
+    signal(SIGINT, SIG_DFL);
+    signal(SIGTERM, SIG_DFL);
+
+    for (;;) {
+        int connection = accept(listener, NULL, NULL);
+        if (connection < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            exit(1);
+        }
+        handle_connection(connection, listener, handler);
+        close(connection);
+    }
+}
+
+/*
+ * Starts a worker process.
+ *
+ * @return          Process ID of the worker.
+ */
+static pid_t start_worker(int listener, RequestHandler handler)
+{
+    fflush(NULL);
+    pid_t pid = fork();
+    if (pid == 0)
+        work(listener, handler);
+    return pid;
+}
+
+void serve(const char *path, size_t workers, RequestHandler handler)
+{
+    struct sockaddr_un addr;
+    socket_address(&addr, path);
+
+    if (!workers) {
+        long processors = sysconf(_SC_NPROCESSORS_ONLN);
+        workers = processors > 0 ? processors : 1;
+    }
+
+    int listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (listener < 0)
+        die("Failed to create socket.");
+
+    /* Remove the socket left by a server that no longer runs. */
+    if (connect(listener, (struct sockaddr *)&addr, sizeof(addr)) == 0)
+        die("Server is already running.");
+    close(listener);
+    unlink(path);
+
+    /*
+     * Requests run with the permissions of the server, so only its user may connect.
+     * The socket is created with mode 0600 instead of changing it after bind,
+     * which would leave it open to everyone in between.
+     */
+    listener = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    mode_t mask = umask(0177);
+    int bound = listener >= 0 && !bind(listener, (struct sockaddr *)&addr, sizeof(addr));
+    umask(mask);
+    if (!bound || listen(listener, SOMAXCONN))
+        die("Failed to listen on socket.");
+
+    struct sigaction action = { .sa_handler = stop };
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    pid_t *pids = malloc(workers * sizeof(pid_t));
+    if (!pids)
+        die("Memory allocation failed.");
+
+    for (size_t i = 0; i < workers; ++i)
+        pids[i] = start_worker(listener, handler);
+
+    /* Replace workers that exit until the server is stopped. */
+    while (!stopping) {
+        pid_t pid = wait(NULL);
+        if (pid < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        for (size_t i = 0; i < workers; ++i)
+            if (pids[i] == pid && !stopping)
+                pids[i] = start_worker(listener, handler);
+    }
+
+    for (size_t i = 0; i < workers; ++i)
+        if (pids[i] > 0)
+            kill(pids[i], SIGTERM);
+    while (wait(NULL) > 0 || errno == EINTR)
+        ;
+
+    free(pids);
+    close(listener);
+    unlink(path);
+}
+
+int request_server(const char *path, size_t argc, char **argv)
+{
+    struct sockaddr_un addr;
+    if (strlen(path) >= sizeof(addr.sun_path))
+        return -1;
+    socket_address(&addr, path);
+
+    int connection = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (connection < 0)
+        return -1;
+
+    if (connect(connection, (struct sockaddr *)&addr, sizeof(addr))) {
+        close(connection);
+        return -1;
+    }
+
+    /* Serialize the current directory and arguments. */
+    char cwd[PATH_MAX];
+    if (!getcwd(cwd, sizeof(cwd))) {
+        close(connection);
+        return -1;
+    }
+
+    size_t length = strlen(cwd) + 1;
+    for (size_t i = 0; i < argc; ++i)
+        length += strlen(argv[i]) + 1;
+
+    char *request = length <= REQUEST_LIMIT ? malloc(length) : NULL;
+    if (!request) {
+        close(connection);
+        return -1;
+    }
+
+    size_t position = 0;
+    strcpy(request, cwd);
+    position += strlen(cwd) + 1;
+    for (size_t i = 0; i < argc; ++i) {
+        strcpy(request + position, argv[i]);
+        position += strlen(argv[i]) + 1;
+    }
+
+    /* Send the length with standard descriptors, then the request. */
+    uint32_t header = length;
+    int fds[REQUEST_DESCRIPTORS] = { STDIN_FILENO, STDOUT_FILENO, STDERR_FILENO };
+    char control[CMSG_SPACE(sizeof(fds))];
+    memset(control, 0, sizeof(control));
+
+    struct iovec iov = { .iov_base = &header, .iov_len = sizeof(header) };
+    struct msghdr message = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control,
+        .msg_controllen = sizeof(control)
+    };
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    signal(SIGPIPE, SIG_IGN);
+
+    int32_t status;
+    char failed = sendmsg(connection, &message, 0) != sizeof(header)
+        || write_all(connection, request, length)
+        || read_all(connection, &status, sizeof(status), NULL);
+
+    free(request);
+    close(connection);
+
+    if (failed)
+        return -1;
+    return status;
+}
@@ -6,7 +6,24 @@ Settings settings = {
     .output_file = NULL,
     .stack_size = 30000,
     .cell_size = 1,
-    .assembly = 0,
+    .emit = EMIT_EXECUTABLE,
+    .assembler = ASSEMBLER_NASM,
+    .march = MARCH_X86_64,
+    .stats = 0,
+    .debug = 0,
+    .tape = TAPE_AUTO,
+    .optimize_size = 0,
+    .memoize = 0,
+    .introspect = 0,
+    .introspect_file = "",
+    .max_steps = 0,
+    .max_output = 0,
+    .max_time = 0,
+    .fork_server = 0,
+    .serve = NULL,
+    .workers = 0,
+    .run = 0,
+    .jit_threshold = 1000,
     .operation_register = "r12b",
     .data_unit = "byte"
 };
@@ -0,0 +1,165 @@
+#include <elf.h>
+#include <stdio.h>
+#include <sys/resource.h>
+#include <time.h>
+
+#include "settings.h"
+#include "stats.h"
+
+Stats stats = { 0 };
+
+static const char *phase_names[PHASE_COUNT] = {
+    "read",
+    "compile",
+    "lex",
+    "write",
+    "assemble",
+    "link",
+    "run"
+};
+
+static const char *optimization_names[OPT_COUNT] = {
+    "run_folding",
+    "dead_loops",
+    "evaluated_loops",
+    "closed_form_loops",
+    "unrolled_loops",
+    "clear_loops",
+    "io_loops",
+    "outlined_sequences",
+    "jit_loops",
+    "branchless_ifs",
+    "memoized_loops",
+    "scan_loops"
+};
+
+/*
+ * Returns CPU time in seconds used by the process and its waited-for children.
+ */
+static double cpu_time()
+{
+    struct rusage self, children;
+    getrusage(RUSAGE_SELF, &self);
+    getrusage(RUSAGE_CHILDREN, &children);
+
+    return self.ru_utime.tv_sec + self.ru_stime.tv_sec
+        + children.ru_utime.tv_sec + children.ru_stime.tv_sec
+        + (self.ru_utime.tv_usec + self.ru_stime.tv_usec
+              + children.ru_utime.tv_usec + children.ru_stime.tv_usec)
+        / 1e6;
+}
+
+/*
+ * Returns number of gigabytes of code lexed per second.
+ */
+static double lex_throughput()
+{
+    double wall = stats.phases[PHASE_LEX].wall;
+    return wall > 0 ? stats.lexed_bytes / wall / 1e9 : 0;
+}
+
+void stats_start(int phase)
+{
+    if (!settings.stats)
+        return;
+
+    clock_gettime(CLOCK_MONOTONIC, &stats.phases[phase].wall_start);
+    stats.phases[phase].cpu_start = cpu_time();
+}
+
+void stats_stop(int phase)
+{
+    if (!settings.stats)
+        return;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    Phase *p = &stats.phases[phase];
+    p->ran = 1;
+    p->wall += (now.tv_sec - p->wall_start.tv_sec)
+        + (now.tv_nsec - p->wall_start.tv_nsec) / 1e9;
+    p->cpu += cpu_time() - p->cpu_start;
+}
+
+size_t text_size(const char *path)
+{
+    FILE *file = fopen(path, "rb");
+    if (!file)
+        return 0;
+
+    size_t size = 0;
+    Elf64_Ehdr header;
+    Elf64_Shdr section;
+
+    if (fread(&header, sizeof(header), 1, file) == 1
+        && header.e_ident[EI_CLASS] == ELFCLASS64
+        && header.e_shentsize == sizeof(section)) {
+        for (int i = 0; i < header.e_shnum; ++i) {
+            if (fseek(file, header.e_shoff + i * sizeof(section), SEEK_SET)
+                || fread(&section, sizeof(section), 1, file) != 1)
+                break;
+            if (section.sh_flags & SHF_EXECINSTR)
+                size += section.sh_size;
+        }
+    }
+
+    fclose(file);
+    return size;
+}
+
+void print_stats(FILE *stream)
+{
+    struct rusage self, children;
+    getrusage(RUSAGE_SELF, &self);
+    getrusage(RUSAGE_CHILDREN, &children);
+
+    if (settings.stats == STATS_JSON) {
+        fprintf(stream, "{\"phases\":{");
+        char first = 1;
+        for (int i = 0; i < PHASE_COUNT; ++i) {
+            if (!stats.phases[i].ran)
+                continue;
+            fprintf(stream, "%s\"%s\":{\"wall_ms\":%.3f,\"cpu_ms\":%.3f}",
+                first ? "" : ",", phase_names[i],
+                stats.phases[i].wall * 1e3, stats.phases[i].cpu * 1e3);
+            first = 0;
+        }
+
+        fprintf(stream, "},\"input_bytes\":%zu,\"lex_gb_per_s\":%.3f,\"bf_ops\":%zu,"
+                        "\"instructions\":%zu,\"loops\":%zu,\"optimizations\":{",
+            stats.input_bytes, lex_throughput(), stats.bf_ops, stats.instructions, stats.loops);
+        for (int i = 0; i < OPT_COUNT; ++i)
+            fprintf(stream, "%s\"%s\":%zu", i ? "," : "",
+                optimization_names[i], stats.optimizations[i]);
+
+        fprintf(stream, "},\"assembly_bytes\":%zu,\"text_bytes\":%zu,"
+                        "\"peak_rss_kib\":%ld,\"peak_child_rss_kib\":%ld}\n",
+            stats.assembly_bytes, stats.text_bytes, self.ru_maxrss, children.ru_maxrss);
+        return;
+    }
+
+    fprintf(stream, "Statistics:\n"
+                    "  %-12s %12s %12s\n",
+        "phase", "wall (ms)", "cpu (ms)");
+    for (int i = 0; i < PHASE_COUNT; ++i)
+        if (stats.phases[i].ran)
+            fprintf(stream, "  %-12s %12.3f %12.3f\n", phase_names[i],
+                stats.phases[i].wall * 1e3, stats.phases[i].cpu * 1e3);
+
+    fprintf(stream, "  %-24s %zu\n", "input bytes:", stats.input_bytes);
+    fprintf(stream, "  %-24s %.3f\n", "lexer (GB/s):", lex_throughput());
+    fprintf(stream, "  %-24s %zu\n", "brainfuck ops:", stats.bf_ops);
+    fprintf(stream, "  %-24s %zu\n", "folded instructions:", stats.instructions);
+    fprintf(stream, "  %-24s %zu\n", "loops:", stats.loops);
+    for (int i = 0; i < OPT_COUNT; ++i) {
+        char label[64];
+        snprintf(label, sizeof(label), "%s:", optimization_names[i]);
+        fprintf(stream, "  %-24s %zu\n", label, stats.optimizations[i]);
+    }
+    fprintf(stream, "  %-24s %zu\n", "assembly bytes:", stats.assembly_bytes);
+    if (stats.text_bytes)
+        fprintf(stream, "  %-24s %zu\n", "text bytes:", stats.text_bytes);
+    fprintf(stream, "  %-24s %ld\n", "peak memory (KiB):", self.ru_maxrss);
+    fprintf(stream, "  %-24s %ld\n", "peak child memory (KiB):", children.ru_maxrss);
+}
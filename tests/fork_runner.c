@@ -0,0 +1,150 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "runtime.h"
+
+/*
+ * Runs an executable built with --fork_server several times through its fork server.
+ *
+ * Usage: fork_runner <executable> <input file>
+ *
+ * Every run reads the input file as its standard input. If all runs write the same output
+ * it's written once to the standard output. Exits with the exit status of the runs,
+ * or 1 if they differ or the server fails.
+ */
+
+#define RUNS 3
+
+/*
+ * Output of a run.
+ */
+typedef struct {
+    size_t length;
+    char *data;
+} Output;
+
+static void fail(const char *msg)
+{
+    fprintf(stderr, "fork_runner: %s\n", msg);
+    exit(1);
+}
+
+/*
+ * Sends a request with the descriptors of standard input and output of the run.
+ */
+static void request(int server, int input, int output)
+{
+    int fds[2] = { input, output };
+    char control[CMSG_SPACE(sizeof(fds))];
+    memset(control, 0, sizeof(control));
+
+    char byte = 'r';
+    struct iovec iov = { .iov_base = &byte, .iov_len = 1 };
+    struct msghdr message = {
+        .msg_iov = &iov,
+        .msg_iovlen = 1,
+        .msg_control = control,
+        .msg_controllen = sizeof(control)
+    };
+
+    struct cmsghdr *cmsg = CMSG_FIRSTHDR(&message);
+    cmsg->cmsg_level = SOL_SOCKET;
+    cmsg->cmsg_type = SCM_RIGHTS;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(fds));
+    memcpy(CMSG_DATA(cmsg), fds, sizeof(fds));
+
+    if (sendmsg(server, &message, 0) != 1)
+        fail("Failed to send a request.");
+}
+
+/*
+ * Reads the output of a run until it closes the pipe.
+ */
+static Output read_output(int fd)
+{
+    Output output = { 0, NULL };
+    size_t size = 0;
+
+    for (;;) {
+        if (output.length == size) {
+            size = size ? size * 2 : 4096;
+            output.data = realloc(output.data, size);
+            if (!output.data)
+                fail("Memory allocation failed.");
+        }
+        ssize_t count = read(fd, output.data + output.length, size - output.length);
+        if (count < 0)
+            fail("Failed to read output.");
+        if (!count)
+            return output;
+        output.length += count;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 3)
+        fail("Usage: fork_runner <executable> <input file>");
+
+    int sockets[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, sockets))
+        fail("Failed to create socket.");
+
+    pid_t server = fork();
+    if (server < 0)
+        fail("Failed to start the executable.");
+    if (server == 0) {
+        dup2(sockets[1], FORK_SERVER_FD);
+        close(sockets[0]);
+        close(sockets[1]);
+        execl(argv[1], argv[1], (char *)NULL);
+        _exit(127);
+    }
+    close(sockets[1]);
+
+    Output first = { 0, NULL };
+    int status = 0;
+    for (int i = 0; i < RUNS; ++i) {
+        int input = open(argv[2], O_RDONLY);
+        int output[2];
+        if (input < 0 || pipe(output))
+            fail("Failed to open input or output.");
+
+        request(sockets[0], input, output[1]);
+        close(input);
+        close(output[1]);
+
+        Output run = read_output(output[0]);
+        close(output[0]);
+
+        if (recv(sockets[0], &status, sizeof(status), MSG_WAITALL) != sizeof(status))
+            fail("Server didn't report status of a run.");
+        if (!WIFEXITED(status))
+            fail("Run didn't exit.");
+
+        if (!i) {
+            first = run;
+        } else {
+            if (run.length != first.length || memcmp(run.data, first.data, run.length))
+                fail("Runs wrote different output.");
+            free(run.data);
+        }
+    }
+
+    /* The server exits with status 0 when the socket is closed. */
+    close(sockets[0]);
+    int server_status;
+    if (waitpid(server, &server_status, 0) != server
+        || !WIFEXITED(server_status) || WEXITSTATUS(server_status))
+        fail("Server didn't exit with status 0.");
+
+    fwrite(first.data, 1, first.length, stdout);
+    free(first.data);
+
+    return WEXITSTATUS(status);
+}
@@ -0,0 +1,32 @@
+#!/bin/sh
+#
+# Checks the report of a program built with --introspect when it receives SIGUSR1.
+#
+# Usage: introspect.sh <bfcomp> <program> <directory> [options...]
+#
+# The program must run until it's stopped and must not read or write. The report is
+# looked for in <directory>/introspect.report, so pass --introspect=<directory>/introspect.report
+# to test reports written to a file, and --introspect to test reports written to stderr.
+#
+bfcomp=$1
+program=$2
+directory=$3
+shift 3
+
+output=$directory/program
+report=$directory/introspect.report
+
+mkdir -p "$directory"
+rm -f "$report"
+"$bfcomp" "$program" -o "$output" "$@" || exit 1
+
+"$output" < /dev/null 2> "$directory/introspect.err" &
+pid=$!
+sleep 0.5
+kill -USR1 $pid
+sleep 0.2
+kill $pid
+wait $pid
+
+[ -f "$report" ] || report=$directory/introspect.err
+grep -q '^bf: line 2, column [0-9]*, cell [01], loop tests [0-9]*, reads 0, writes 0$' "$report"
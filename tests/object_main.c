@@ -0,0 +1,25 @@
+#include <unistd.h>
+
+#include "bfcomp.h"
+
+/*
+ * Runs an object built with --emit=object with standard input and output,
+ * like the example of the README. The tape fits 30000 cells of 8 bytes.
+ */
+
+static long read_input(void *context, unsigned char *buffer, size_t length)
+{
+    return read(0, buffer, length);
+}
+
+static long write_output(void *context, const unsigned char *buffer, size_t length)
+{
+    return write(1, buffer, length) == (ssize_t)length ? 0 : -1;
+}
+
+int main(void)
+{
+    static unsigned char tape[30000 * 8];
+    bf_io io = { read_input, write_output, NULL };
+    return bf_main(&io, tape, sizeof(tape));
+}
@@ -0,0 +1,2 @@
+Copies the input to the output until a 0 character
+,[.,]
@@ -0,0 +1,8 @@
+Reads three characters and counts those that aren't 0 with loops that run at most once
+,[>>>+<<<[-]]
+>,[>>+<<[-]]
+>,[>+<[-]]
+Prints the count as a letter starting at A
+>>++++++++[<++++++++>-]<+.
+Newline
+[-]++++++++++.
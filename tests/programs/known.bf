@@ -0,0 +1,20 @@
+Loops whose cells are known when the program is compiled
+
+The first cell is 0 when the program starts so this loop is never entered
+[>+++<-]
+
+Nested loops reading only known cells are evaluated and print A
++++++[>+++++[>++<-]<-]>>+++++++++++++++.
+
+A loop with a known trip count of 3 is unrolled and prints A three times
+>>+++[<<.>>-]
+
+A loop with a known trip count adding to a character read from the input
+is replaced by its total change and prints the character plus 4
+<,>++++[<+>-]<.
+
+The same character is unknown so this loop runs and prints its double
+[>++<-]>.
+
+Newline
+[-]++++++++++.
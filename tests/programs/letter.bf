@@ -0,0 +1,2 @@
+Prints A without moving so that any stack size can be used
++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++.
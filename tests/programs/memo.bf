@@ -0,0 +1,12 @@
+Reads the number of rounds and then a value for every round
+Every round runs the same nest of loops without input or output on the value
+which memoization replaces with the cached result after the first round
+,[
+    >>>>>>>>>,
+    [>>>>+<<<<>>>---<<<>+++[>++[>-<>+++<>-<>++<-]<>>>>+++<<<<-]<>+[>>>>+<<<<>>>>++<<<<>+++[>>>++<<<-]<-]<-]
+    >>>+++++++++++++++++++++++++++++++++++.<<<
+    >>>[-]>[-]>[-]<<<<<
+    <<<<<<<<<-
+]
+Newline
+++++++++++.
@@ -0,0 +1,5 @@
+Repeats the same sequence which reads a character and prints its double
+>,[>+>+<<-]>[<+>-]>[<<+>>-]<<.
+>,[>+>+<<-]>[<+>-]>[<<+>>-]<<.
+>,[>+>+<<-]>[<+>-]>[<<+>>-]<<.
+>,[>+>+<<-]>[<+>-]>[<<+>>-]<<.
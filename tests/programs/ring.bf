@@ -0,0 +1,13 @@
+Run with a stack of 8 cells
+
+Moving left from the first cell wraps around to the last one and prints A
+<++++++++[>++++++++<-]>+.
+
+Scanning right from cell 6 wraps around to cell 3 and prints B
+>+>+>>>>+>+<[>]++++++++[<++++++++>-]<+.
+
+Scanning left from cell 2 wraps around to cell 5 and prints C
+[<]++++++++[>++++++++<-]>++.
+
+Newline
+>[-]++++++++++.
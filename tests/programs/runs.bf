@@ -0,0 +1,6 @@
+Runs of commands crossing blocks of 32 bytes are folded whole
++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++.
+Prints A and then B from a run split by a comment in the middle of a block
+++++++++++++++++++++comment+++++++++++------------------------------------------------------------++++++++++++++++++++++++++++++.
+Newline
+>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>>><<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<<>[-]++++++++++.
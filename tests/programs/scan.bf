@@ -0,0 +1,5 @@
+Reads characters up to a zero into the cells after the first one
+
+Scans right to the end and left back to the start over more cells than a vector
+then prints the characters and a newline
+>,[>,]<[<]>[>]<[<]>[.>]++++++++++.
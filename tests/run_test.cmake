@@ -0,0 +1,66 @@
+# Builds a brainfuck program with bfcomp, runs it and compares its output with the expected one.
+#
+# BFCOMP    bfcomp executable.
+# PROGRAM   Brainfuck source.
+# OPTIONS   Options of bfcomp separated by spaces, with --run the program runs in bfcomp.
+# INPUT     Standard input of the program, empty if not set.
+# EXPECTED  File with the expected output.
+# STATUS    Expected exit status of the program, 0 if not set.
+# ERROR     Regular expression matching errors of bfcomp and the program, if set.
+# OUTPUT    Path of the built program.
+# RUNNER    Executable running the built program, with its path and INPUT as arguments, if set.
+# HARNESS   C program linked with objects built with --emit object by the compiler CC,
+#           including headers from INCLUDE.
+
+string(FIND "${OPTIONS}" "--emit object" object)
+separate_arguments(OPTIONS UNIX_COMMAND "${OPTIONS}")
+if (NOT INPUT)
+    set(INPUT /dev/null)
+endif()
+if (NOT STATUS)
+    set(STATUS 0)
+endif()
+
+list(FIND OPTIONS --run run)
+if (NOT run EQUAL -1)
+    execute_process(COMMAND ${BFCOMP} -i ${PROGRAM} ${OPTIONS} INPUT_FILE ${INPUT}
+        OUTPUT_VARIABLE output ERROR_VARIABLE errors RESULT_VARIABLE status)
+elseif (object EQUAL -1)
+    execute_process(COMMAND ${BFCOMP} -i ${PROGRAM} -o ${OUTPUT} ${OPTIONS}
+        ERROR_VARIABLE build_errors RESULT_VARIABLE status)
+else()
+    execute_process(COMMAND ${BFCOMP} -i ${PROGRAM} -o ${OUTPUT}.o ${OPTIONS}
+        ERROR_VARIABLE build_errors RESULT_VARIABLE status)
+endif()
+if (run EQUAL -1 AND NOT status EQUAL 0)
+    message(FATAL_ERROR "bfcomp failed: ${status}\n${build_errors}")
+endif()
+
+if (run EQUAL -1 AND NOT object EQUAL -1)
+    execute_process(COMMAND ${CC} -I${INCLUDE} ${HARNESS} ${OUTPUT}.o -o ${OUTPUT}
+        ERROR_VARIABLE link_errors RESULT_VARIABLE status)
+    if (NOT status EQUAL 0)
+        message(FATAL_ERROR "Linking the object failed: ${status}\n${link_errors}")
+    endif()
+endif()
+if (run EQUAL -1 AND RUNNER)
+    execute_process(COMMAND ${RUNNER} ${OUTPUT} ${INPUT}
+        OUTPUT_VARIABLE output ERROR_VARIABLE errors RESULT_VARIABLE status)
+    set(errors "${build_errors}${errors}")
+elseif (run EQUAL -1)
+    execute_process(COMMAND ${OUTPUT} INPUT_FILE ${INPUT}
+        OUTPUT_VARIABLE output ERROR_VARIABLE errors RESULT_VARIABLE status)
+    set(errors "${build_errors}${errors}")
+endif()
+
+if (NOT status EQUAL STATUS)
+    message(FATAL_ERROR "Program exited with ${status} instead of ${STATUS}:\n${errors}")
+endif()
+if (ERROR AND NOT errors MATCHES "${ERROR}")
+    message(FATAL_ERROR "Errors:\n${errors}\ndon't match:\n${ERROR}")
+endif()
+
+file(READ ${EXPECTED} expected)
+if (NOT output STREQUAL expected)
+    message(FATAL_ERROR "Output:\n${output}\nExpected:\n${expected}")
+endif()
@@ -0,0 +1,35 @@
+#!/bin/sh
+#
+# Builds a program through a compile server and compares its output with the expected one.
+#
+# Usage: server.sh <bfcomp> <program> <expected> <directory> [options...]
+#
+# The options are passed to both the server and the client. The client runs without PATH,
+# so the build only succeeds if the server does it.
+#
+bfcomp=$1
+program=$2
+expected=$3
+directory=$4
+shift 4
+
+socket=$directory/server.sock
+output=$directory/server_program
+
+"$bfcomp" --serve "$socket" --workers 2 "$@" &
+server=$!
+trap 'kill $server 2>/dev/null' EXIT
+
+tries=0
+while [ ! -S "$socket" ]; do
+    tries=$((tries + 1))
+    [ $tries -gt 100 ] && exit 1
+    sleep 0.05
+done
+
+# Only the user of the server may connect.
+[ "$(stat -c %a "$socket")" = 600 ] || exit 1
+
+rm -f "$output"
+BFCOMP_SERVER=$socket PATH=/nonexistent "$bfcomp" "$program" -o "$output" "$@" || exit 1
+"$output" < /dev/null | cmp - "$expected"